@@ -0,0 +1,249 @@
+/*
+ * GPIO-BCM - maps the GPIO and System Timer registers for gpio-bcm.h
+ *
+ * A platform driver: the two register windows come from the device tree
+ * (a node with one of the compatibles below and reg = <gpio>, <timer>)
+ * or, when there is no such node, from a platform device this module
+ * registers itself for soc= (2835, 2837 or 2711).  The mapped bases are
+ * exported to the drivers built on gpio-bcm.h, so load this module
+ * first:
+ *
+ *   insmod gpio-bcm.ko soc=2837 bench_pin=16 bench_toggles=1000000
+ *   insmod gpio-i2c.ko ...
+ *
+ * The windows are normally claimed by pinctrl-bcm2835 and the timer
+ * driver already.  devm_ioremap_resource() then fails with -EBUSY and
+ * the registers are mapped shared instead, as the old fixed virtual
+ * mapping effectively did.
+ *
+ * The drivers using the mappings hold a reference on this module through
+ * the exported symbols, so it cannot go away under them; unbinding the
+ * device through sysfs is disabled for the same reason.
+ *
+ * gpio-ok01 to gpio-ok04 are the steps before this layer existed and keep
+ * their fixed 0xF2000000 virtual mapping; they neither need gpio-bcm nor
+ * take gpio_bcm_lock.
+ *
+ * bench_toggles toggles bench_pin with writel_relaxed() and with writel()
+ * and reports the cost of both, i.e. what dropping the barriers saves.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/platform_device.h>
+#include <linux/of.h>
+#include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "gpio-bcm.h"
+
+/*
+ * Debug option
+ */
+#define GPIO_BCM_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef GPIO_BCM_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[GPIO-BCM] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module name */
+#define DEV_BCM_NAME "gpio-bcm"
+
+void __iomem *gpio_bcm_regs;
+EXPORT_SYMBOL_GPL(gpio_bcm_regs);
+void __iomem *gpio_bcm_timer;
+EXPORT_SYMBOL_GPL(gpio_bcm_timer);
+unsigned int gpio_bcm_soc;
+EXPORT_SYMBOL_GPL(gpio_bcm_soc);
+DEFINE_SPINLOCK(gpio_bcm_lock);
+EXPORT_SYMBOL_GPL(gpio_bcm_lock);
+
+static unsigned int soc = 2837;
+module_param(soc, uint, 0444);
+MODULE_PARM_DESC(soc, "SoC without a device tree node: 2835, 2837 or 2711");
+
+static unsigned int bench_pin = 16;
+module_param(bench_pin, uint, 0444);
+MODULE_PARM_DESC(bench_pin, "Output pin toggled by the benchmark");
+
+static unsigned int bench_toggles;
+module_param(bench_toggles, uint, 0444);
+MODULE_PARM_DESC(bench_toggles, "Toggle bench_pin this many times at load and report the cost");
+
+static struct platform_device *bcm_pdev;
+
+
+static phys_addr_t bcm_peri_base(unsigned int id)
+{
+	switch (id) {
+	case 2835:
+		return BCM2835_PERI_PHYS;
+	case 2837:
+		return BCM2837_PERI_PHYS;
+	case 2711:
+		return BCM2711_PERI_PHYS;
+	}
+	return 0;
+}
+
+/* map one window, sharing it if another driver already claimed it */
+static void __iomem *bcm_map(struct platform_device *pdev, unsigned int idx)
+{
+	struct resource *res = platform_get_resource(pdev, IORESOURCE_MEM, idx);
+	void __iomem *base;
+
+	if (!res) {
+		return IOMEM_ERR_PTR(-EINVAL);
+	}
+	base = devm_ioremap_resource(&pdev->dev, res);
+	if (IS_ERR(base) && PTR_ERR(base) == -EBUSY) {
+		dev_info(&pdev->dev, "%pR busy, mapping it shared\n", res);
+		base = devm_ioremap(&pdev->dev, res->start, resource_size(res));
+		if (!base) {
+			base = IOMEM_ERR_PTR(-ENOMEM);
+		}
+	}
+	return base;
+}
+
+/* ns per set/clear pair of bench_pin with relaxed and ordered writes */
+static void bcm_benchmark(void)
+{
+	unsigned int bank = bench_pin / 32, bit = 1U << (bench_pin % 32);
+	u64 start, relaxed, ordered;
+	unsigned int i;
+
+	func_pin(bench_pin, M_OUTPUT);
+
+	start = ktime_get_ns();
+	for (i = 0; i < bench_toggles; i++) {
+		writel_relaxed(bit, gpio_bcm_regs + GPSET0 + bank * 4);
+		writel_relaxed(bit, gpio_bcm_regs + GPCLR0 + bank * 4);
+	}
+	gpio_bcm_wmb();
+	relaxed = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < bench_toggles; i++) {
+		writel(bit, gpio_bcm_regs + GPSET0 + bank * 4);
+		writel(bit, gpio_bcm_regs + GPCLR0 + bank * 4);
+	}
+	ordered = ktime_get_ns() - start;
+
+	func_pin(bench_pin, M_INPUT);
+
+	printk(KERN_INFO "[GPIO-BCM] %u toggles: writel_relaxed %llu ns/toggle, writel %llu ns/toggle\n",
+	       bench_toggles, div_u64(relaxed, bench_toggles), div_u64(ordered, bench_toggles));
+}
+
+static int bcm_probe(struct platform_device *pdev)
+{
+	const void *match = of_device_get_match_data(&pdev->dev);
+	void __iomem *regs, *timer;
+
+	regs = bcm_map(pdev, 0);
+	if (IS_ERR(regs)) {
+		return PTR_ERR(regs);
+	}
+	timer = bcm_map(pdev, 1);
+	if (IS_ERR(timer)) {
+		return PTR_ERR(timer);
+	}
+
+	gpio_bcm_soc = match ? (unsigned int)(uintptr_t)match : soc;
+	gpio_bcm_timer = timer;
+	gpio_bcm_regs = regs;
+
+	dev_info(&pdev->dev, "BCM%u GPIO registers mapped\n", gpio_bcm_soc);
+
+	if (bench_toggles && bench_pin <= GPIO_MAX_PIN) {
+		bcm_benchmark();
+	}
+	return 0;
+}
+
+/* only reached on module unload, once no driver uses the mappings */
+static void bcm_remove(struct platform_device *pdev)
+{
+	gpio_bcm_regs = NULL;
+	gpio_bcm_timer = NULL;
+}
+
+static const struct of_device_id bcm_of_match[] = {
+	{ .compatible = "brcm,bcm2835-gpio-regs", .data = (void *)2835 },
+	{ .compatible = "brcm,bcm2837-gpio-regs", .data = (void *)2837 },
+	{ .compatible = "brcm,bcm2711-gpio-regs", .data = (void *)2711 },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, bcm_of_match);
+
+static struct platform_driver bcm_driver = {
+	.driver = {
+		.name = DEV_BCM_NAME,
+		.of_match_table = bcm_of_match,
+		.suppress_bind_attrs = true,
+	},
+	.probe = bcm_probe,
+	.remove = bcm_remove,
+};
+
+
+static int gpio_bcm_init(void)
+{
+	phys_addr_t peri = bcm_peri_base(soc);
+	struct resource res[] = {
+		DEFINE_RES_MEM(peri + GPIO_OFFSET,
+			       soc == 2711 ? GPIO_REG_END_2711 : GPIO_REG_END),
+		DEFINE_RES_MEM(peri + TIMER_OFFSET, TIMER_REG_END),
+	};
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	if (!peri) {
+		return -EINVAL;
+	}
+
+	ret = platform_driver_register(&bcm_driver);
+	if (ret) {
+		return ret;
+	}
+
+	/* no device tree node bound: describe the SoC ourselves */
+	if (!gpio_bcm_regs) {
+		bcm_pdev = platform_device_register_simple(DEV_BCM_NAME, PLATFORM_DEVID_NONE,
+							   res, ARRAY_SIZE(res));
+		if (IS_ERR(bcm_pdev)) {
+			platform_driver_unregister(&bcm_driver);
+			return PTR_ERR(bcm_pdev);
+		}
+	}
+
+	if (gpio_bcm_ready()) {
+		platform_device_unregister(bcm_pdev);
+		platform_driver_unregister(&bcm_driver);
+		return -ENODEV;
+	}
+	return 0;
+}
+
+static void gpio_bcm_exit(void)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	platform_device_unregister(bcm_pdev);
+	platform_driver_unregister(&bcm_driver);
+}
+
+
+module_init(gpio_bcm_init);
+module_exit(gpio_bcm_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("BCM2835/2837/2711 GPIO and System Timer register mapping");
@@ -0,0 +1,535 @@
+/*
+ * BCM2835/2837/2711 GPIO and System Timer register layer
+ *
+ * func_pin(), set_pin() and the System Timer helpers from gpio-ok05,
+ * shared by the drivers that need more than one pin at a time.
+ *
+ * On hardware the registers are mapped by the gpio-bcm platform driver
+ * (gpio-bcm.c), which has to be loaded first; drivers check
+ * gpio_bcm_ready() in their init.  Accesses are readl_relaxed() /
+ * writel_relaxed(): they stay in order towards the GPIO block, and
+ * gpio_bcm_wmb() is only needed where a write has to land before a
+ * timed wait, as in the pull sequence.
+ *
+ * GPFSEL holds ten pins per register and the pull registers clock all
+ * pins of a bank at once, so every read-modify-write of GPFSEL and every
+ * pull sequence runs under gpio_bcm_lock.  It is exported by gpio-bcm
+ * like the mappings, which makes it one lock for all the drivers.
+ *
+ * All register traffic goes through gpio_read_reg()/gpio_write_reg(), so
+ * defining GPIO_BCM_SIMULATE before including this file swaps the
+ * hardware for an in-memory BCM2837 register file:
+ *   - outputs read back their GPSET/GPCLR latch on GPLEV
+ *   - inputs read as high (as if pulled up) unless their bit is set in
+ *     gpio_sim_input_low, which a test harness may flip to fake edges
+ *   - the System Timer follows ktime
+ *   - every register store is counted in gpio_sim_stores
+ *   - pulls clocked in through GPPUDCLK are kept in gpio_sim_pull
+ * which is enough to benchmark the drivers on any machine.
+ */
+#ifndef GPIO_BCM_H
+#define GPIO_BCM_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+#include <linux/delay.h>
+#include <linux/errno.h>
+#include <linux/spinlock.h>
+
+/* Macro for function select (mode)
+ * 000 : input
+ * 001 : output
+ * 100 : alternate function 0
+ * 101 : alternate function 1
+ * 110 : alternate function 2
+ * 111 : alternate function 3
+ * 011 : alternate function 4
+ * 010 : alternate function 5
+ */
+#define M_INPUT 0
+#define M_OUTPUT 1
+
+/* Macro for GPIO status */
+#define S_LOW 0
+#define S_HIGH 1
+
+/* LED status */
+#define S_OFF 0
+#define S_ON 1
+
+/* Macro for pull-up/down control (GPPUD) */
+#define PULL_OFF 0
+#define PULL_DOWN 1
+#define PULL_UP 2
+#define PULL_STATES 3
+
+/* we can control total 54 gpio, 32 per bank */
+#define GPIO_MAX_PIN 53
+#define GPIO_BANKS 2
+
+/* register offsets from GPIO base */
+#define GPFSEL0 0x00
+#define GPSET0 0x1C
+#define GPCLR0 0x28
+#define GPLEV0 0x34
+#define GPEDS0 0x40
+#define GPPUD 0x94
+#define GPPUDCLK0 0x98
+#define GPPUDCLK1 0x9C
+#define GPIO_REG_END 0xB4
+
+/* BCM2711 replaces GPPUD/GPPUDCLK with 2 bits per pin in 4 registers */
+#define GPPUPPDN0 0xE4
+#define GPIO_REG_END_2711 0xF4
+
+/* peripheral base on the physical (ARM) address map, per SoC */
+#define BCM2835_PERI_PHYS 0x20000000
+#define BCM2837_PERI_PHYS 0x3F000000
+#define BCM2711_PERI_PHYS 0xFE000000
+
+/* GPIO and System Timer offsets from the peripheral base */
+#define GPIO_OFFSET 0x00200000
+#define TIMER_OFFSET 0x00003000
+#define TIMER_REG_END 0x1C
+
+/* System Timer counter, lower and higher 32 bits */
+#define TIMER_CLO 0x04
+#define TIMER_CHI 0x08
+
+
+#ifdef GPIO_BCM_SIMULATE
+
+static unsigned int gpio_sim_regs[GPIO_REG_END / sizeof(unsigned int)];
+static unsigned int gpio_sim_latch[GPIO_BANKS];
+static unsigned int gpio_sim_input_low[GPIO_BANKS];
+static unsigned long gpio_sim_stores;
+static unsigned char gpio_sim_pull[GPIO_MAX_PIN + 1];
+static const unsigned int gpio_bcm_soc = 2837;
+static DEFINE_SPINLOCK(gpio_bcm_lock);
+
+static inline int gpio_bcm_ready(void)
+{
+	return 0;
+}
+
+static inline void gpio_bcm_wmb(void)
+{
+}
+
+static inline unsigned int gpio_sim_fsel(unsigned int pin)
+{
+	return (gpio_sim_regs[pin / 10] >> ((pin % 10) * 3)) & 0x07;
+}
+
+static inline unsigned int gpio_read_reg(unsigned int offset)
+{
+	unsigned int bank, pin, level = 0;
+
+	if (offset != GPLEV0 && offset != GPLEV0 + 4) {
+		return gpio_sim_regs[offset / sizeof(unsigned int)];
+	}
+
+	bank = (offset - GPLEV0) / sizeof(unsigned int);
+	for (pin = bank * 32; pin <= GPIO_MAX_PIN && pin < (bank + 1) * 32; pin++) {
+		unsigned int bit = 1U << (pin % 32);
+
+		if (gpio_sim_fsel(pin) == M_OUTPUT) {
+			level |= gpio_sim_latch[bank] & bit;
+		} else {
+			level |= ~gpio_sim_input_low[bank] & bit;
+		}
+	}
+	return level;
+}
+
+static inline void gpio_write_reg(unsigned int offset, unsigned int val)
+{
+	gpio_sim_stores++;
+	if (offset >= GPSET0 && offset < GPSET0 + 8) {
+		gpio_sim_latch[(offset - GPSET0) / 4] |= val;
+	} else if (offset >= GPCLR0 && offset < GPCLR0 + 8) {
+		gpio_sim_latch[(offset - GPCLR0) / 4] &= ~val;
+	} else if (offset >= GPEDS0 && offset < GPEDS0 + 8) {
+		/* event status bits are write 1 to clear */
+		gpio_sim_regs[offset / sizeof(unsigned int)] &= ~val;
+	} else if (offset == GPPUDCLK0 || offset == GPPUDCLK1) {
+		/* clocked pins take the control value currently in GPPUD */
+		unsigned int bank = (offset - GPPUDCLK0) / 4, bit;
+
+		for (bit = 0; bit < 32 && bank * 32 + bit <= GPIO_MAX_PIN; bit++) {
+			if (val & (1U << bit)) {
+				gpio_sim_pull[bank * 32 + bit] =
+					gpio_sim_regs[GPPUD / sizeof(unsigned int)];
+			}
+		}
+		gpio_sim_regs[offset / sizeof(unsigned int)] = val;
+	} else {
+		gpio_sim_regs[offset / sizeof(unsigned int)] = val;
+	}
+}
+
+/* return time stamp in microseconds */
+static inline u64 get_time_stamp(void)
+{
+	return ktime_get_ns() / NSEC_PER_USEC;
+}
+
+#else
+
+#include <linux/io.h>
+
+/* mapped by gpio-bcm.c */
+extern void __iomem *gpio_bcm_regs;
+extern void __iomem *gpio_bcm_timer;
+/* 2835, 2837 or 2711 */
+extern unsigned int gpio_bcm_soc;
+/* GPFSEL and pull register updates */
+extern spinlock_t gpio_bcm_lock;
+
+/* 0 once gpio-bcm has mapped the registers */
+static inline int gpio_bcm_ready(void)
+{
+	return gpio_bcm_regs && gpio_bcm_timer ? 0 : -ENODEV;
+}
+
+/* make the register writes so far reach the device before going on */
+static inline void gpio_bcm_wmb(void)
+{
+	wmb();
+}
+
+static inline unsigned int gpio_read_reg(unsigned int offset)
+{
+	return readl_relaxed(gpio_bcm_regs + offset);
+}
+
+static inline void gpio_write_reg(unsigned int offset, unsigned int val)
+{
+	writel_relaxed(val, gpio_bcm_regs + offset);
+}
+
+/*
+ * return time stamp in microseconds
+ * The counter is two 32 bit registers, so re-read the high word to catch
+ * a carry out of the low word between the two reads.
+ */
+static inline u64 get_time_stamp(void)
+{
+	unsigned int hi, lo;
+
+	do {
+		hi = readl_relaxed(gpio_bcm_timer + TIMER_CHI);
+		lo = readl_relaxed(gpio_bcm_timer + TIMER_CLO);
+	} while (hi != readl_relaxed(gpio_bcm_timer + TIMER_CHI));
+
+	return ((u64)hi << 32) | lo;
+}
+
+#endif /* GPIO_BCM_SIMULATE */
+
+
+/* busy wait delay microseconds on the System Timer */
+static inline int timer_wait(const unsigned long delay)
+{
+	u64 start = get_time_stamp();
+
+	while (get_time_stamp() - start < delay)
+		;
+	return 0;
+}
+
+/* write val, cut by mask, at shift of the register at offset */
+static inline int set_bits(const unsigned int offset,
+			   const unsigned int shift,
+			   const unsigned int val,
+			   const unsigned int mask)
+{
+	unsigned long flags;
+	unsigned int temp;
+
+	spin_lock_irqsave(&gpio_bcm_lock, flags);
+	temp = gpio_read_reg(offset);
+
+	/* initialize an assigned part */
+	temp &= ~(mask << shift);
+
+	/* set val into addr */
+	temp |= (val & mask) << shift;
+	gpio_write_reg(offset, temp);
+	spin_unlock_irqrestore(&gpio_bcm_lock, flags);
+
+	return 0;
+}
+
+/* assign a function of pin_num to mode, see M_INPUT / M_OUTPUT */
+static inline int func_pin(const unsigned int pin_num,
+			   const unsigned int mode)
+{
+	/* we can control total 53 gpio */
+	if (pin_num > GPIO_MAX_PIN) {
+		return -1;
+	}
+
+	/* one gpio can be reprented by 3 bits */
+	if (mode > 7) {
+		return -1;
+	}
+
+	/* we can set 10 gpio function to one register */
+	set_bits(GPFSEL0 + (pin_num / 10) * 4, (pin_num % 10) * 3, mode, 0x07);
+	return 0;
+}
+
+/* drive an output pin to status (S_ON / S_OFF) */
+static inline int set_pin(const unsigned int pin_num,
+			  const unsigned int status)
+{
+	unsigned int bank = pin_num / 32;
+
+	if (pin_num > GPIO_MAX_PIN) {
+		return -1;
+	}
+
+	if (status != S_OFF && status != S_ON) {
+		return -1;
+	}
+
+	/* GPSET/GPCLR only act on the 1 bits, no read-modify-write needed */
+	gpio_write_reg((status == S_ON ? GPSET0 : GPCLR0) + bank * 4,
+		       1U << (pin_num % 32));
+	return 0;
+}
+
+/*
+ * BCM2711: one read-modify-write per 16 pin register that has pins in
+ * mask, no clocking.  Note the encoding differs from GPPUD.
+ * gpio_bcm_lock held.
+ */
+static inline void gpio_pull_mask_2711(const unsigned int pull,
+				       const unsigned int mask[GPIO_BANKS])
+{
+	static const unsigned int code[PULL_STATES] = {
+		[PULL_OFF] = 0, [PULL_UP] = 1, [PULL_DOWN] = 2,
+	};
+	unsigned int reg, i, pin, val;
+
+	for (reg = 0; reg < 4; reg++) {
+		unsigned int bits = (mask[reg / 2] >> ((reg % 2) * 16)) & 0xFFFF;
+
+		if (!bits) {
+			continue;
+		}
+		val = gpio_read_reg(GPPUPPDN0 + reg * 4);
+		for (i = 0; i < 16; i++) {
+			pin = reg * 16 + i;
+			if ((bits & (1U << i)) && pin <= GPIO_MAX_PIN) {
+				val &= ~(0x03 << (i * 2));
+				val |= code[pull] << (i * 2);
+			}
+		}
+		gpio_write_reg(GPPUPPDN0 + reg * 4, val);
+	}
+}
+
+/*
+ * set the pull of every pin in mask (per bank) to pull, which the caller
+ * has checked; gpio_bcm_lock held
+ * The BCM2835/2837 sequence: write the control to GPPUD, wait 150
+ * cycles, clock it into the pins with GPPUDCLK0/1, wait 150 cycles, then
+ * remove both.  Both banks are clocked in the same sequence.
+ */
+static inline void gpio_pull_apply(const unsigned int pull,
+				   const unsigned int mask[GPIO_BANKS])
+{
+	if (!mask[0] && !mask[1]) {
+		return;
+	}
+
+	if (gpio_bcm_soc == 2711) {
+		gpio_pull_mask_2711(pull, mask);
+		return;
+	}
+
+	gpio_write_reg(GPPUD, pull);
+	gpio_bcm_wmb();
+	udelay(1);
+	gpio_write_reg(GPPUDCLK0, mask[0]);
+	gpio_write_reg(GPPUDCLK1, mask[1]);
+	gpio_bcm_wmb();
+	udelay(1);
+	gpio_write_reg(GPPUD, PULL_OFF);
+	gpio_write_reg(GPPUDCLK0, 0);
+	gpio_write_reg(GPPUDCLK1, 0);
+}
+
+/* set the pull of every pin in mask (per bank) to pull (PULL_OFF/DOWN/UP) */
+static inline int gpio_pull_mask(const unsigned int pull,
+				 const unsigned int mask[GPIO_BANKS])
+{
+	unsigned long flags;
+
+	if (pull >= PULL_STATES) {
+		return -1;
+	}
+
+	spin_lock_irqsave(&gpio_bcm_lock, flags);
+	gpio_pull_apply(pull, mask);
+	spin_unlock_irqrestore(&gpio_bcm_lock, flags);
+	return 0;
+}
+
+/*
+ * set pulls[i] on pins[i] for n pins
+ * Pins are grouped by pull state, so this runs at most one GPPUD/GPPUDCLK
+ * sequence per state however many pins are given.
+ */
+static inline int gpio_pull_pins(const unsigned int *pins,
+				 const unsigned int *pulls,
+				 const unsigned int n)
+{
+	unsigned int mask[PULL_STATES][GPIO_BANKS] = { { 0 } };
+	unsigned int i, pull;
+
+	for (i = 0; i < n; i++) {
+		if (pins[i] > GPIO_MAX_PIN || pulls[i] >= PULL_STATES) {
+			return -1;
+		}
+		mask[pulls[i]][pins[i] / 32] |= 1U << (pins[i] % 32);
+	}
+	for (pull = 0; pull < PULL_STATES; pull++) {
+		gpio_pull_mask(pull, mask[pull]);
+	}
+	return 0;
+}
+
+/* set the pull of one pin, see gpio_pull_pins() for several */
+static inline int pull_pin(const unsigned int pin_num,
+			   const unsigned int pull)
+{
+	return gpio_pull_pins(&pin_num, &pull, 1);
+}
+
+/* read the level of one pin, 0 or 1 */
+static inline int get_pin(const unsigned int pin_num)
+{
+	if (pin_num > GPIO_MAX_PIN) {
+		return -1;
+	}
+	return (gpio_read_reg(GPLEV0 + (pin_num / 32) * 4) >> (pin_num % 32)) & 1;
+}
+
+/* set every pin of bank given in mask with a single store */
+static inline void gpio_set_mask(unsigned int bank, unsigned int mask)
+{
+	if (mask) {
+		gpio_write_reg(GPSET0 + bank * 4, mask);
+	}
+}
+
+/* clear every pin of bank given in mask with a single store */
+static inline void gpio_clr_mask(unsigned int bank, unsigned int mask)
+{
+	if (mask) {
+		gpio_write_reg(GPCLR0 + bank * 4, mask);
+	}
+}
+
+/* levels of all pins of a bank */
+static inline unsigned int gpio_get_levels(unsigned int bank)
+{
+	return gpio_read_reg(GPLEV0 + bank * 4);
+}
+
+
+/*
+ * Pin group: an ordered set of pins written as one word, bit 0 on pins[0]
+ * The scatter table maps each byte of the word to the bank bits it sets,
+ * so a write is a few table lookups and one GPSET plus one GPCLR store
+ * per bank, whatever the width and wherever the pins are.
+ */
+#define GPIO_GROUP_MAX 32
+
+struct gpio_group {
+	unsigned int npins;
+	unsigned char pins[GPIO_GROUP_MAX];
+	/* all bits of the group, per bank */
+	unsigned int mask[GPIO_BANKS];
+	/* scatter[lane][byte value][bank] */
+	unsigned int scatter[GPIO_GROUP_MAX / 8][256][GPIO_BANKS];
+};
+
+static inline int gpio_group_init(struct gpio_group *g,
+				  const unsigned int *pins,
+				  unsigned int npins)
+{
+	unsigned int i, lane, val, bit;
+
+	if (npins == 0 || npins > GPIO_GROUP_MAX) {
+		return -1;
+	}
+
+	memset(g, 0, sizeof(*g));
+	g->npins = npins;
+	for (i = 0; i < npins; i++) {
+		if (pins[i] > GPIO_MAX_PIN) {
+			return -1;
+		}
+		g->pins[i] = pins[i];
+		g->mask[pins[i] / 32] |= 1U << (pins[i] % 32);
+	}
+
+	for (lane = 0; lane * 8 < npins; lane++) {
+		for (val = 0; val < 256; val++) {
+			for (bit = 0; bit < 8 && lane * 8 + bit < npins; bit++) {
+				unsigned int pin = pins[lane * 8 + bit];
+
+				if (val & (1U << bit)) {
+					g->scatter[lane][val][pin / 32] |= 1U << (pin % 32);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* per bank set masks of word; the clear masks are mask ^ set */
+static inline void gpio_group_scatter(const struct gpio_group *g,
+				      unsigned int word,
+				      unsigned int set[GPIO_BANKS])
+{
+	unsigned int lane, bank;
+
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		set[bank] = 0;
+	}
+	for (lane = 0; lane * 8 < g->npins; lane++, word >>= 8) {
+		for (bank = 0; bank < GPIO_BANKS; bank++) {
+			set[bank] |= g->scatter[lane][word & 0xFF][bank];
+		}
+	}
+}
+
+/* drive the whole group to word */
+static inline void gpio_group_write(const struct gpio_group *g, unsigned int word)
+{
+	unsigned int set[GPIO_BANKS], bank;
+
+	gpio_group_scatter(g, word, set);
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		gpio_set_mask(bank, set[bank]);
+		gpio_clr_mask(bank, g->mask[bank] & ~set[bank]);
+	}
+}
+
+/* switch every pin of the group to mode */
+static inline void gpio_group_func(const struct gpio_group *g, unsigned int mode)
+{
+	unsigned int i;
+
+	for (i = 0; i < g->npins; i++) {
+		func_pin(g->pins[i], mode);
+	}
+}
+
+#endif /* GPIO_BCM_H */
@@ -0,0 +1,389 @@
+/*
+ * GPIO-I2C - bit-banged I2C master on two arbitrary GPIO pins
+ *
+ * Registers a real i2c_adapter, so with i2c-dev loaded the bus shows up
+ * as /dev/i2c-N and i2c-app works on it unchanged.
+ *
+ * The lines are open drain: a low is driven by switching the pin to
+ * output with its latch cleared, a high by switching it back to input
+ * and letting the pull-up raise it.  SCL edges are placed on absolute
+ * deadlines counted on the System Timer, so time spent in func_pin()
+ * and the level checks is absorbed instead of slowing the clock down.
+ * The timer ticks in microseconds, so half periods are rounded up to
+ * whole ticks and never shorter than two: a low phase of one tick can
+ * last barely 1 us, below the 1.3 us tLOW of Fast-mode.  The SCL rate
+ * actually used is 500 / half period in us kHz: bus_khz=100 runs at 100
+ * kHz, 300 or 400 at 250 kHz.
+ *
+ *   insmod gpio-i2c.ko sda=23 scl=24 bus_khz=400 bench_bytes=1000
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/i2c.h>
+#include <linux/math64.h>
+
+#include "gpio-bcm.h"
+
+/*
+ * Debug option
+ */
+#define GPIO_I2C_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef GPIO_I2C_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[GPIO-I2C] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module name */
+#define DEV_I2C_NAME "gpio-i2c"
+
+/* how long a slave may hold SCL low (clock stretching) */
+#define STRETCH_TIMEOUT_US 10000
+
+static unsigned int sda = 23;
+module_param(sda, uint, 0444);
+MODULE_PARM_DESC(sda, "GPIO used as SDA");
+
+static unsigned int scl = 24;
+module_param(scl, uint, 0444);
+MODULE_PARM_DESC(scl, "GPIO used as SCL");
+
+static unsigned int bus_khz = 100;
+module_param(bus_khz, uint, 0444);
+MODULE_PARM_DESC(bus_khz, "SCL frequency in kHz (1-400), rounded down to whole us half periods");
+
+static int nr = -1;
+module_param(nr, int, 0444);
+MODULE_PARM_DESC(nr, "I2C bus number, -1 for dynamic");
+
+static unsigned int bench_bytes;
+module_param(bench_bytes, uint, 0444);
+MODULE_PARM_DESC(bench_bytes, "Clock out this many bytes at load and report the rate");
+
+/* shortest half SCL period in System Timer ticks, see above */
+#define BB_MIN_HALF_US 2
+
+struct bb_i2c {
+	struct i2c_adapter adap;
+	/* half SCL period in ns, whole microseconds */
+	u64 half_ns;
+	/* deadline of the next edge in ns on the System Timer */
+	u64 next_ns;
+};
+
+static struct bb_i2c bb_bus;
+
+
+/* open drain emulation: drive low */
+static inline void bb_low(unsigned int pin)
+{
+	func_pin(pin, M_OUTPUT);
+}
+
+/* open drain emulation: let the pull-up take the line high */
+static inline void bb_release(unsigned int pin)
+{
+	func_pin(pin, M_INPUT);
+}
+
+/* start a new edge schedule from now */
+static void bb_sync(struct bb_i2c *bb)
+{
+	bb->next_ns = get_time_stamp() * NSEC_PER_USEC;
+}
+
+/*
+ * wait until the next half period boundary
+ * If we fell more than a half period behind (preempted, stretched) the
+ * schedule restarts from now rather than rushing the next edges.
+ */
+static void bb_tick(struct bb_i2c *bb)
+{
+	u64 now;
+
+	bb->next_ns += bb->half_ns;
+	while ((now = get_time_stamp() * NSEC_PER_USEC) < bb->next_ns)
+		;
+	if (now - bb->next_ns > bb->half_ns) {
+		bb->next_ns = now;
+	}
+}
+
+/* release SCL and wait for it to go high, honouring clock stretching */
+static int bb_scl_high(struct bb_i2c *bb)
+{
+	u64 start;
+
+	bb_release(scl);
+	if (get_pin(scl)) {
+		return 0;
+	}
+
+	start = get_time_stamp();
+	while (!get_pin(scl)) {
+		if (get_time_stamp() - start > STRETCH_TIMEOUT_US) {
+			return -ETIMEDOUT;
+		}
+	}
+	/* the slave decides when the high phase starts */
+	bb_sync(bb);
+	return 0;
+}
+
+static void bb_start(struct bb_i2c *bb)
+{
+	bb_sync(bb);
+	bb_low(sda);
+	bb_tick(bb);
+	bb_low(scl);
+	bb_tick(bb);
+}
+
+static int bb_repstart(struct bb_i2c *bb)
+{
+	int ret;
+
+	bb_release(sda);
+	bb_tick(bb);
+	ret = bb_scl_high(bb);
+	if (ret) {
+		return ret;
+	}
+	bb_tick(bb);
+	bb_start(bb);
+	return 0;
+}
+
+/* SDA is released even if SCL never came up, the error is returned */
+static int bb_stop(struct bb_i2c *bb)
+{
+	int ret;
+
+	bb_low(sda);
+	bb_tick(bb);
+	ret = bb_scl_high(bb);
+	bb_tick(bb);
+	bb_release(sda);
+	bb_tick(bb);
+	return ret;
+}
+
+/* clock one bit out; SCL is low on entry and on return */
+static int bb_write_bit(struct bb_i2c *bb, int bit)
+{
+	int ret;
+
+	if (bit) {
+		bb_release(sda);
+	} else {
+		bb_low(sda);
+	}
+	bb_tick(bb);
+	ret = bb_scl_high(bb);
+	if (ret) {
+		return ret;
+	}
+	bb_tick(bb);
+	bb_low(scl);
+	return 0;
+}
+
+/* clock one bit in, sampled at the end of the high phase */
+static int bb_read_bit(struct bb_i2c *bb)
+{
+	int ret, bit;
+
+	bb_release(sda);
+	bb_tick(bb);
+	ret = bb_scl_high(bb);
+	if (ret) {
+		return ret;
+	}
+	bb_tick(bb);
+	bit = get_pin(sda);
+	bb_low(scl);
+	return bit;
+}
+
+/* returns 0 on ACK, 1 on NACK or a negative error */
+static int bb_write_byte(struct bb_i2c *bb, u8 byte)
+{
+	int i, ret;
+
+	for (i = 7; i >= 0; i--) {
+		ret = bb_write_bit(bb, (byte >> i) & 1);
+		if (ret) {
+			return ret;
+		}
+	}
+	return bb_read_bit(bb);
+}
+
+static int bb_read_byte(struct bb_i2c *bb, u8 *byte, int ack)
+{
+	int i, bit, ret;
+	u8 val = 0;
+
+	for (i = 0; i < 8; i++) {
+		bit = bb_read_bit(bb);
+		if (bit < 0) {
+			return bit;
+		}
+		val = (val << 1) | bit;
+	}
+	ret = bb_write_bit(bb, !ack);
+	*byte = val;
+	return ret;
+}
+
+static int bb_xfer_msg(struct bb_i2c *bb, struct i2c_msg *msg)
+{
+	int i, ret;
+
+	ret = bb_write_byte(bb, i2c_8bit_addr_from_msg(msg));
+	if (ret) {
+		return ret < 0 ? ret : -ENXIO;
+	}
+
+	for (i = 0; i < msg->len; i++) {
+		if (msg->flags & I2C_M_RD) {
+			/* ACK every byte but the last one */
+			ret = bb_read_byte(bb, &msg->buf[i], i < msg->len - 1);
+		} else {
+			ret = bb_write_byte(bb, msg->buf[i]);
+			if (ret > 0) {
+				ret = -EIO;
+			}
+		}
+		if (ret) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int bb_master_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	struct bb_i2c *bb = i2c_get_adapdata(adap);
+	int i, ret = 0, stop;
+
+	bb_start(bb);
+	for (i = 0; i < num; i++) {
+		if (i > 0) {
+			ret = bb_repstart(bb);
+			if (ret) {
+				break;
+			}
+		}
+		ret = bb_xfer_msg(bb, &msgs[i]);
+		if (ret) {
+			break;
+		}
+	}
+	stop = bb_stop(bb);
+	if (!ret) {
+		ret = stop;
+	}
+
+	return ret ? ret : num;
+}
+
+static u32 bb_functionality(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm bb_algo = {
+	.master_xfer = bb_master_xfer,
+	.functionality = bb_functionality,
+};
+
+/* clock out bench_bytes bytes (ACK or not) and report the SCL rate */
+static void bb_benchmark(struct bb_i2c *bb)
+{
+	u64 start, elapsed;
+	unsigned int i;
+
+	start = get_time_stamp();
+	bb_start(bb);
+	for (i = 0; i < bench_bytes; i++) {
+		bb_write_byte(bb, 0x55);
+	}
+	bb_stop(bb);
+	elapsed = get_time_stamp() - start;
+
+	printk(KERN_INFO "[GPIO-I2C] %u bytes in %llu us: %llu kHz SCL (target %llu kHz)\n",
+	       bench_bytes, elapsed,
+	       elapsed ? div64_u64((u64)bench_bytes * 9 * 1000, elapsed) : 0,
+	       div64_u64(NSEC_PER_SEC / 2, bb->half_ns * 1000));
+}
+
+
+static int gpio_i2c_init(void)
+{
+	struct bb_i2c *bb = &bb_bus;
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	/* registers are mapped by gpio-bcm */
+	if (gpio_bcm_ready()) {
+		return -ENODEV;
+	}
+
+	if (sda > GPIO_MAX_PIN || scl > GPIO_MAX_PIN || sda == scl ||
+	    bus_khz == 0 || bus_khz > 400) {
+		return -EINVAL;
+	}
+	bb->half_ns = max_t(u64, DIV_ROUND_UP(USEC_PER_SEC / 2 / 1000, bus_khz),
+			    BB_MIN_HALF_US) * NSEC_PER_USEC;
+
+	/* preset both latches low, then release: the bus idles high */
+	set_pin(sda, S_OFF);
+	set_pin(scl, S_OFF);
+	bb_release(sda);
+	bb_release(scl);
+
+	bb->adap.owner = THIS_MODULE;
+	bb->adap.algo = &bb_algo;
+	bb->adap.nr = nr;
+	bb->adap.retries = 0;
+	snprintf(bb->adap.name, sizeof(bb->adap.name),
+		 "%s sda=%u scl=%u", DEV_I2C_NAME, sda, scl);
+	i2c_set_adapdata(&bb->adap, bb);
+
+	if (bench_bytes) {
+		bb_benchmark(bb);
+	}
+
+	ret = nr >= 0 ? i2c_add_numbered_adapter(&bb->adap)
+		      : i2c_add_adapter(&bb->adap);
+	if (ret) {
+		return ret;
+	}
+
+	PDEBUG("registered i2c-%d at %llu kHz\n", bb->adap.nr,
+	       div64_u64(NSEC_PER_SEC / 2, bb->half_ns * 1000));
+	return 0;
+}
+
+static void gpio_i2c_exit(void)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	i2c_del_adapter(&bb_bus.adap);
+	bb_release(sda);
+	bb_release(scl);
+}
+
+
+module_init(gpio_i2c_init);
+module_exit(gpio_i2c_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Bit-banged I2C master on BCM2837 GPIO");
@@ -0,0 +1,701 @@
+/*
+ * GPIO-INPUT - debounced edge events from GPIO inputs
+ *
+ * Every pin in pins= is switched to input with func_pin() and watched
+ * through its edge interrupt.  A raw edge does not reach userspace by
+ * itself: it (re)arms a per-pin hrtimer debounce_us in the future, and
+ * only when the timer expires is the line read back.  If it settled on
+ * a level different from the last one reported, one event is queued;
+ * the whole bounce burst in between is only counted.
+ *
+ * read() returns struct gpio_input_event records (see gpio-input.h) and
+ * blocks until one is available, poll() is supported.  Debounce times
+ * can be changed per pin and the raw/filtered/delivered counters read
+ * back with ioctls.
+ *
+ *   insmod gpio-input.ko pins=17,27 debounce_us=5000,20000 gpio_base=512
+ *   mknod /dev/gpio-input c 234 0
+ *
+ * gpio_base is where the SoC GPIO chip starts in the kernel numbering
+ * (0 on older kernels, 512 on current ones), used to find the IRQs.
+ *
+ * Like NAPI, the driver leaves interrupt mode when edges come faster
+ * than irq_threshold per millisecond: the pin IRQs are disabled and an
+ * hrtimer polls GPLEV every poll_us instead, so the CPU cost is bounded
+ * by the poll rate however fast the lines toggle.  Polling only sees
+ * levels: a pulse that starts and ends between two polls is lost, and an
+ * odd number of edges between two polls counts as one.  GPEDS is no help
+ * here, pinctrl-bcm2835 clears the edge enables while the IRQ is masked
+ * and owns the register besides.  After quiet_polls passes without a
+ * change the IRQs are turned back on.  The switch counters and the CPU time of
+ * both paths are read with GPIO_INPUT_IOC_MODE_STATS.
+ *
+ * Built with GPIO_BCM_SIMULATE there are no IRQs; sim_hz instead starts
+ * an edge generator that toggles the inputs in bursts of sim_burst_ms
+ * separated by sim_quiet_ms of silence, sim_cycles times, and logs the
+ * statistics when done.  Compare with irq_threshold=0, which never
+ * leaves interrupt mode:
+ *
+ *   insmod gpio-input.ko pins=17,27 sim_hz=200000 irq_threshold=0
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/uaccess.h>
+
+#include "gpio-bcm.h"
+#include "gpio-input.h"
+
+/*
+ * Debug option
+ */
+#define GPIO_INPUT_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef GPIO_INPUT_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[GPIO-INPUT] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module major number */
+static int DEV_INPUT_MAJOR_NUMBER = 234;
+/* Module name */
+#define DEV_INPUT_NAME "gpio-input"
+
+/* most pins watched at once */
+#define INPUT_MAX_PINS 16
+
+/* queued events, must be a power of two */
+#define INPUT_FIFO_EVENTS 1024
+
+static unsigned int pins[INPUT_MAX_PINS] = { 17 };
+static unsigned int npins = 1;
+module_param_array(pins, uint, &npins, 0444);
+MODULE_PARM_DESC(pins, "Input pins to watch");
+
+static unsigned int debounce_us[INPUT_MAX_PINS];
+static unsigned int ndebounce;
+module_param_array(debounce_us, uint, &ndebounce, 0444);
+MODULE_PARM_DESC(debounce_us, "Debounce time per pin in microseconds, the last one applies to the rest");
+
+static unsigned int gpio_base;
+module_param(gpio_base, uint, 0444);
+MODULE_PARM_DESC(gpio_base, "Kernel GPIO number of BCM pin 0");
+
+static unsigned int irq_threshold = 20;
+module_param(irq_threshold, uint, 0444);
+MODULE_PARM_DESC(irq_threshold, "Edges per millisecond that switch to polling, 0 never polls");
+
+static unsigned int poll_us = 50;
+module_param(poll_us, uint, 0444);
+MODULE_PARM_DESC(poll_us, "Poll period in microseconds");
+
+static unsigned int quiet_polls = 20;
+module_param(quiet_polls, uint, 0444);
+MODULE_PARM_DESC(quiet_polls, "Polls without an edge before going back to IRQs");
+
+#ifdef GPIO_BCM_SIMULATE
+static unsigned int sim_hz;
+module_param(sim_hz, uint, 0444);
+MODULE_PARM_DESC(sim_hz, "Simulated edge rate during a burst, 0 disables the generator");
+
+static unsigned int sim_burst_ms = 100;
+module_param(sim_burst_ms, uint, 0444);
+MODULE_PARM_DESC(sim_burst_ms, "Length of a simulated burst");
+
+static unsigned int sim_quiet_ms = 100;
+module_param(sim_quiet_ms, uint, 0444);
+MODULE_PARM_DESC(sim_quiet_ms, "Silence between simulated bursts");
+
+static unsigned int sim_cycles = 10;
+module_param(sim_cycles, uint, 0444);
+MODULE_PARM_DESC(sim_cycles, "Number of simulated bursts");
+#endif
+
+struct input_pin {
+	unsigned int pin;
+	int irq;
+	/* protects everything below */
+	spinlock_t lock;
+	u64 debounce_ns;
+	struct hrtimer timer;
+	/* level last reported to readers */
+	int stable;
+	u64 last_edge_us;
+	u64 raw;
+	u64 filtered;
+	u64 delivered;
+	u64 dropped;
+};
+
+struct input_dev {
+	struct input_pin pin[INPUT_MAX_PINS];
+	unsigned int npins;
+	DECLARE_KFIFO(fifo, struct gpio_input_event, INPUT_FIFO_EVENTS);
+	/* serializes producers (timers and IRQs of all pins) */
+	spinlock_t fifo_lock;
+	/* serializes readers against each other */
+	struct mutex read_lock;
+	wait_queue_head_t wait;
+
+	/* protects the IRQ/polling state below */
+	spinlock_t mode_lock;
+	/* being torn down: the mode no longer changes */
+	bool stopping;
+	/* pins watched, per bank */
+	unsigned int watch[GPIO_BANKS];
+	/* edge rate estimate in IRQ mode: edges since window_us */
+	u64 window_us;
+	unsigned int window_edges;
+	/* levels seen by the previous poll */
+	unsigned int poll_lev[GPIO_BANKS];
+	unsigned int quiet;
+	struct hrtimer poll_timer;
+	struct gpio_input_mode_stats ms;
+#ifdef GPIO_BCM_SIMULATE
+	struct hrtimer gen_timer;
+	u64 gen_start_ns;
+	u64 gen_edges;
+	unsigned int gen_next;
+#endif
+};
+
+static struct input_dev input_dev;
+
+
+static struct input_pin *input_find(struct input_dev *in, unsigned int pin)
+{
+	unsigned int i;
+
+	for (i = 0; i < in->npins; i++) {
+		if (in->pin[i].pin == pin) {
+			return &in->pin[i];
+		}
+	}
+	return NULL;
+}
+
+/* queue an event if level differs from the last one; ip->lock held */
+static void input_settle(struct input_dev *in, struct input_pin *ip, int level)
+{
+	struct gpio_input_event ev;
+
+	if (level == ip->stable) {
+		/* bounced back: the edge that opened the window was noise */
+		ip->filtered++;
+		return;
+	}
+	ip->stable = level;
+
+	ev.timestamp_us = ip->last_edge_us;
+	ev.pin = ip->pin;
+	ev.level = level;
+	if (kfifo_in_spinlocked(&in->fifo, &ev, 1, &in->fifo_lock)) {
+		ip->delivered++;
+		wake_up_interruptible(&in->wait);
+	} else {
+		ip->dropped++;
+	}
+}
+
+/* the line has been quiet for debounce_ns, take its level */
+static enum hrtimer_restart input_timer(struct hrtimer *t)
+{
+	struct input_pin *ip = container_of(t, struct input_pin, timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ip->lock, flags);
+	input_settle(&input_dev, ip, get_pin(ip->pin));
+	spin_unlock_irqrestore(&ip->lock, flags);
+	return HRTIMER_NORESTART;
+}
+
+/* one raw edge on ip, from its IRQ or the poller */
+static void input_raw_edge(struct input_dev *in, struct input_pin *ip)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ip->lock, flags);
+	ip->raw++;
+	ip->last_edge_us = get_time_stamp();
+	if (!ip->debounce_ns) {
+		input_settle(in, ip, get_pin(ip->pin));
+	} else {
+		/* an edge inside a running window only pushes it out */
+		if (hrtimer_active(&ip->timer)) {
+			ip->filtered++;
+		}
+		hrtimer_start(&ip->timer, ns_to_ktime(ip->debounce_ns), HRTIMER_MODE_REL);
+	}
+	spin_unlock_irqrestore(&ip->lock, flags);
+}
+
+/* hand the edges from poll back to the IRQs; in->mode_lock held */
+static void input_enter_irq(struct input_dev *in)
+{
+	unsigned int i, bank, lev[GPIO_BANKS];
+
+	in->ms.mode = GPIO_INPUT_MODE_IRQ;
+	in->ms.to_irq++;
+	in->window_us = get_time_stamp();
+	in->window_edges = 0;
+
+	for (i = 0; i < in->npins; i++) {
+		if (in->pin[i].irq >= 0) {
+			enable_irq(in->pin[i].irq);
+		}
+	}
+
+	/* an edge between the last poll and enable_irq() raised no IRQ */
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		lev[bank] = gpio_get_levels(bank);
+	}
+	for (i = 0; i < in->npins; i++) {
+		unsigned int pin = in->pin[i].pin;
+
+		if ((lev[pin / 32] ^ in->poll_lev[pin / 32]) & (1U << (pin % 32))) {
+			input_raw_edge(in, &in->pin[i]);
+		}
+	}
+}
+
+/* too many IRQs: mask them and start polling; in->mode_lock held */
+static void input_enter_poll(struct input_dev *in)
+{
+	unsigned int i, bank;
+
+	in->ms.mode = GPIO_INPUT_MODE_POLL;
+	in->ms.to_poll++;
+	for (i = 0; i < in->npins; i++) {
+		if (in->pin[i].irq >= 0) {
+			disable_irq_nosync(in->pin[i].irq);
+		}
+	}
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		in->poll_lev[bank] = gpio_get_levels(bank);
+	}
+	in->quiet = 0;
+	hrtimer_start(&in->poll_timer, ns_to_ktime((u64)poll_us * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+}
+
+/*
+ * one poll pass: every watched pin whose level changed since the last
+ * pass goes through the debounce logic; pulses shorter than poll_us
+ * are not seen
+ */
+static enum hrtimer_restart input_poll_timer(struct hrtimer *t)
+{
+	struct input_dev *in = container_of(t, struct input_dev, poll_timer);
+	unsigned int i, bank, lev[GPIO_BANKS], edges = 0;
+	enum hrtimer_restart ret = HRTIMER_RESTART;
+	unsigned long flags;
+	u64 start = ktime_get_ns();
+
+	spin_lock_irqsave(&in->mode_lock, flags);
+	if (in->stopping) {
+		spin_unlock_irqrestore(&in->mode_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		lev[bank] = gpio_get_levels(bank);
+	}
+
+	for (i = 0; i < in->npins; i++) {
+		unsigned int pin = in->pin[i].pin;
+		unsigned int bit = 1U << (pin % 32);
+
+		bank = pin / 32;
+		if ((lev[bank] ^ in->poll_lev[bank]) & bit) {
+			input_raw_edge(in, &in->pin[i]);
+			edges++;
+		}
+	}
+	memcpy(in->poll_lev, lev, sizeof(lev));
+
+	in->ms.polls++;
+	in->ms.poll_edges += edges;
+	in->quiet = edges ? 0 : in->quiet + 1;
+	if (in->quiet >= quiet_polls) {
+		input_enter_irq(in);
+		ret = HRTIMER_NORESTART;
+	} else {
+		hrtimer_forward_now(t, ns_to_ktime((u64)poll_us * NSEC_PER_USEC));
+	}
+	in->ms.poll_ns += ktime_get_ns() - start;
+
+	spin_unlock_irqrestore(&in->mode_lock, flags);
+	return ret;
+}
+
+static irqreturn_t input_irq(int irq, void *data)
+{
+	struct input_dev *in = &input_dev;
+	unsigned long flags;
+	u64 start = ktime_get_ns(), now_us;
+
+	input_raw_edge(in, data);
+
+	spin_lock_irqsave(&in->mode_lock, flags);
+	in->ms.irq_edges++;
+	now_us = get_time_stamp();
+	if (now_us - in->window_us >= USEC_PER_MSEC) {
+		in->window_us = now_us;
+		in->window_edges = 0;
+	}
+	if (++in->window_edges > irq_threshold && irq_threshold &&
+	    in->ms.mode == GPIO_INPUT_MODE_IRQ && !in->stopping) {
+		input_enter_poll(in);
+	}
+	in->ms.irq_ns += ktime_get_ns() - start;
+	spin_unlock_irqrestore(&in->mode_lock, flags);
+
+	return IRQ_HANDLED;
+}
+
+
+#ifdef GPIO_BCM_SIMULATE
+static void input_sim_report(struct input_dev *in)
+{
+	struct gpio_input_mode_stats *ms = &in->ms;
+	u64 edges = ms->irq_edges + ms->poll_edges;
+
+	printk(KERN_INFO "[GPIO-INPUT] sim: %llu edges generated, %llu by IRQ, %llu by %llu polls\n",
+	       in->gen_edges, ms->irq_edges, ms->poll_edges, ms->polls);
+	printk(KERN_INFO "[GPIO-INPUT] sim: %llu to poll, %llu to IRQ, cpu %llu ns irq + %llu ns poll, %llu ns/edge\n",
+	       ms->to_poll, ms->to_irq, ms->irq_ns, ms->poll_ns,
+	       edges ? div64_u64(ms->irq_ns + ms->poll_ns, edges) : 0);
+}
+
+/*
+ * simulated edge source: flip the next input round robin and, as long as
+ * the device is in IRQ mode, raise its "interrupt"
+ */
+static enum hrtimer_restart input_gen_timer(struct hrtimer *t)
+{
+	struct input_dev *in = container_of(t, struct input_dev, gen_timer);
+	u64 cycle_ns = (u64)(sim_burst_ms + sim_quiet_ms) * NSEC_PER_MSEC;
+	u64 phase, cycle;
+	struct input_pin *ip;
+
+	cycle = div64_u64_rem(ktime_get_ns() - in->gen_start_ns, cycle_ns, &phase);
+	if (cycle >= sim_cycles) {
+		input_sim_report(in);
+		return HRTIMER_NORESTART;
+	}
+
+	if (phase >= (u64)sim_burst_ms * NSEC_PER_MSEC) {
+		hrtimer_forward_now(t, ns_to_ktime(cycle_ns - phase));
+		return HRTIMER_RESTART;
+	}
+
+	ip = &in->pin[in->gen_next];
+	in->gen_next = (in->gen_next + 1) % in->npins;
+	gpio_sim_input_low[ip->pin / 32] ^= 1U << (ip->pin % 32);
+	in->gen_edges++;
+	if (READ_ONCE(in->ms.mode) == GPIO_INPUT_MODE_IRQ) {
+		input_irq(-1, ip);
+	}
+
+	hrtimer_forward_now(t, ns_to_ktime(NSEC_PER_SEC / sim_hz));
+	return HRTIMER_RESTART;
+}
+#endif
+
+
+static int input_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = &input_dev;
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static int input_release(struct inode *inode, struct file *filp)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+/* hand out as many whole events as fit into the user buffer */
+static ssize_t input_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct input_dev *in = filp->private_data;
+	unsigned int copied;
+	int ret;
+
+	if (count < sizeof(struct gpio_input_event)) {
+		return -EINVAL;
+	}
+
+	if (mutex_lock_interruptible(&in->read_lock)) {
+		return -ERESTARTSYS;
+	}
+
+	while (kfifo_is_empty(&in->fifo)) {
+		mutex_unlock(&in->read_lock);
+		if (filp->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(in->wait, !kfifo_is_empty(&in->fifo))) {
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&in->read_lock)) {
+			return -ERESTARTSYS;
+		}
+	}
+
+	ret = kfifo_to_user(&in->fifo, buf, count, &copied);
+	mutex_unlock(&in->read_lock);
+
+	return ret ? ret : copied;
+}
+
+static __poll_t input_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct input_dev *in = filp->private_data;
+
+	poll_wait(filp, &in->wait, wait);
+	if (!kfifo_is_empty(&in->fifo)) {
+		return EPOLLIN | EPOLLRDNORM;
+	}
+	return 0;
+}
+
+static long input_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct input_dev *in = filp->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct gpio_input_debounce deb;
+	struct gpio_input_stats st;
+	struct gpio_input_mode_stats ms;
+	struct input_pin *ip;
+	unsigned long flags;
+
+	switch (cmd) {
+	case GPIO_INPUT_IOC_DEBOUNCE:
+		if (copy_from_user(&deb, uarg, sizeof(deb))) {
+			return -EFAULT;
+		}
+		ip = input_find(in, deb.pin);
+		if (!ip) {
+			return -EINVAL;
+		}
+		spin_lock_irqsave(&ip->lock, flags);
+		ip->debounce_ns = (u64)deb.debounce_us * NSEC_PER_USEC;
+		spin_unlock_irqrestore(&ip->lock, flags);
+		return 0;
+
+	case GPIO_INPUT_IOC_STATS:
+		if (copy_from_user(&st, uarg, sizeof(st))) {
+			return -EFAULT;
+		}
+		ip = input_find(in, st.pin);
+		if (!ip) {
+			return -EINVAL;
+		}
+		spin_lock_irqsave(&ip->lock, flags);
+		st.debounce_us = div_u64(ip->debounce_ns, NSEC_PER_USEC);
+		st.raw = ip->raw;
+		st.filtered = ip->filtered;
+		st.delivered = ip->delivered;
+		st.dropped = ip->dropped;
+		spin_unlock_irqrestore(&ip->lock, flags);
+		return copy_to_user(uarg, &st, sizeof(st)) ? -EFAULT : 0;
+
+	case GPIO_INPUT_IOC_MODE_STATS:
+		spin_lock_irqsave(&in->mode_lock, flags);
+		ms = in->ms;
+		spin_unlock_irqrestore(&in->mode_lock, flags);
+		return copy_to_user(uarg, &ms, sizeof(ms)) ? -EFAULT : 0;
+	}
+	return -ENOTTY;
+}
+
+static struct file_operations input_fops = {
+	.owner = THIS_MODULE,
+	.open = input_open,
+	.release = input_release,
+	.read = input_read,
+	.poll = input_poll,
+	.unlocked_ioctl = input_ioctl
+};
+
+
+/*
+ * stop the IRQs of the first n pins, then the timers they and the poller
+ * arm.  Once stopping is set neither the IRQs nor the poller switch the
+ * mode any more, so the poll timer is not restarted and the IRQs are not
+ * enabled again behind our back.
+ */
+static void input_teardown(struct input_dev *in, unsigned int n)
+{
+	struct input_pin *ip;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&in->mode_lock, flags);
+	in->stopping = true;
+	spin_unlock_irqrestore(&in->mode_lock, flags);
+
+	for (i = 0; i < n; i++) {
+		ip = &in->pin[i];
+		if (ip->irq >= 0) {
+			if (in->ms.mode == GPIO_INPUT_MODE_POLL) {
+				enable_irq(ip->irq);
+			}
+			free_irq(ip->irq, ip);
+			gpio_free(gpio_base + ip->pin);
+		}
+	}
+	hrtimer_cancel(&in->poll_timer);
+	for (i = 0; i < n; i++) {
+		hrtimer_cancel(&in->pin[i].timer);
+	}
+}
+
+static int input_setup_pin(struct input_dev *in, struct input_pin *ip, unsigned int idx)
+{
+	unsigned int us = ndebounce ? debounce_us[min(idx, ndebounce - 1)] : 0;
+	int ret;
+
+	ip->pin = pins[idx];
+	ip->irq = -1;
+	ip->debounce_ns = (u64)us * NSEC_PER_USEC;
+	spin_lock_init(&ip->lock);
+	hrtimer_setup(&ip->timer, input_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+
+	func_pin(ip->pin, M_INPUT);
+	ip->stable = get_pin(ip->pin);
+
+#ifndef GPIO_BCM_SIMULATE
+	ret = gpio_request(gpio_base + ip->pin, DEV_INPUT_NAME);
+	if (ret) {
+		return ret;
+	}
+	ret = gpio_to_irq(gpio_base + ip->pin);
+	if (ret < 0) {
+		gpio_free(gpio_base + ip->pin);
+		return ret;
+	}
+	ip->irq = ret;
+	ret = request_irq(ip->irq, input_irq,
+			  IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+			  DEV_INPUT_NAME, ip);
+	if (ret) {
+		ip->irq = -1;
+		gpio_free(gpio_base + ip->pin);
+		return ret;
+	}
+#else
+	ret = 0;
+#endif
+	return ret;
+}
+
+static int gpio_input_init(void)
+{
+	struct input_dev *in = &input_dev;
+	unsigned int i;
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	/* registers are mapped by gpio-bcm */
+	if (gpio_bcm_ready()) {
+		return -ENODEV;
+	}
+
+	if (poll_us == 0) {
+		return -EINVAL;
+	}
+#ifdef GPIO_BCM_SIMULATE
+	if (sim_hz && sim_burst_ms + sim_quiet_ms == 0) {
+		return -EINVAL;
+	}
+#endif
+	for (i = 0; i < npins; i++) {
+		if (pins[i] > GPIO_MAX_PIN) {
+			return -EINVAL;
+		}
+	}
+
+	INIT_KFIFO(in->fifo);
+	spin_lock_init(&in->fifo_lock);
+	mutex_init(&in->read_lock);
+	init_waitqueue_head(&in->wait);
+	spin_lock_init(&in->mode_lock);
+	hrtimer_setup(&in->poll_timer, input_poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	in->ms.mode = GPIO_INPUT_MODE_IRQ;
+	in->window_us = get_time_stamp();
+
+	for (i = 0; i < npins; i++) {
+		ret = input_setup_pin(in, &in->pin[i], i);
+		if (ret) {
+			hrtimer_cancel(&in->pin[i].timer);
+			input_teardown(in, i);
+			return ret;
+		}
+		in->npins = i + 1;
+		in->watch[pins[i] / 32] |= 1U << (pins[i] % 32);
+	}
+
+	ret = register_chrdev(DEV_INPUT_MAJOR_NUMBER, DEV_INPUT_NAME, &input_fops);
+	if (ret < 0) {
+		input_teardown(in, in->npins);
+		return ret;
+	}
+
+#ifdef GPIO_BCM_SIMULATE
+	hrtimer_setup(&in->gen_timer, input_gen_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	if (sim_hz) {
+		in->gen_start_ns = ktime_get_ns();
+		hrtimer_start(&in->gen_timer, ns_to_ktime(NSEC_PER_SEC / sim_hz), HRTIMER_MODE_REL);
+	}
+#endif
+	return 0;
+}
+
+static void gpio_input_exit(void)
+{
+	struct input_dev *in = &input_dev;
+	struct input_pin *ip;
+	unsigned int i;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	unregister_chrdev(DEV_INPUT_MAJOR_NUMBER, DEV_INPUT_NAME);
+#ifdef GPIO_BCM_SIMULATE
+	/* the simulated IRQ source goes first, like the real ones below */
+	hrtimer_cancel(&in->gen_timer);
+#endif
+	input_teardown(in, in->npins);
+
+	for (i = 0; i < in->npins; i++) {
+		ip = &in->pin[i];
+		PDEBUG("pin %u: raw %llu, filtered %llu, delivered %llu, dropped %llu\n",
+		       ip->pin, ip->raw, ip->filtered, ip->delivered, ip->dropped);
+	}
+	PDEBUG("to poll %llu, to irq %llu, irq edges %llu, poll edges %llu\n",
+	       in->ms.to_poll, in->ms.to_irq, in->ms.irq_edges, in->ms.poll_edges);
+}
+
+
+module_init(gpio_input_init);
+module_exit(gpio_input_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Debounced GPIO input events on BCM2837");
@@ -0,0 +1,74 @@
+/*
+ * GPIO-INPUT event format and ioctl interface
+ *
+ * read() returns whole struct gpio_input_event records, one per settled
+ * level change of a watched pin.
+ */
+#ifndef GPIO_INPUT_H
+#define GPIO_INPUT_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+#endif
+
+struct gpio_input_event {
+	/* System Timer at the last raw edge before the line settled, us */
+	__u64 timestamp_us;
+	__u32 pin;
+	__u32 level;
+};
+
+/* debounce time of one watched pin, 0 delivers every edge */
+struct gpio_input_debounce {
+	__u32 pin;
+	__u32 debounce_us;
+};
+
+struct gpio_input_stats {
+	/* in: watched pin */
+	__u32 pin;
+	/* out */
+	__u32 debounce_us;
+	/* edges seen on the line */
+	__u64 raw;
+	/* edges swallowed by the debounce filter */
+	__u64 filtered;
+	/* events queued for readers */
+	__u64 delivered;
+	/* events lost because readers did not keep up */
+	__u64 dropped;
+};
+
+/* gpio_input_mode_stats.mode */
+#define GPIO_INPUT_MODE_IRQ 0
+#define GPIO_INPUT_MODE_POLL 1
+
+/* interrupt / polling switch statistics of the whole device */
+struct gpio_input_mode_stats {
+	__u32 mode;
+	__u32 reserved;
+	/* IRQ to polling and back */
+	__u64 to_poll;
+	__u64 to_irq;
+	/* raw edges seen by the IRQ handler and by the poller */
+	__u64 irq_edges;
+	__u64 poll_edges;
+	/* poll passes run */
+	__u64 polls;
+	/* CPU time spent in the IRQ handler and in the poller */
+	__u64 irq_ns;
+	__u64 poll_ns;
+};
+
+#define GPIO_INPUT_IOC_MAGIC 'i'
+#define GPIO_INPUT_IOC_DEBOUNCE _IOW(GPIO_INPUT_IOC_MAGIC, 1, struct gpio_input_debounce)
+#define GPIO_INPUT_IOC_STATS _IOWR(GPIO_INPUT_IOC_MAGIC, 2, struct gpio_input_stats)
+#define GPIO_INPUT_IOC_MODE_STATS _IOR(GPIO_INPUT_IOC_MAGIC, 3, struct gpio_input_mode_stats)
+
+#endif /* GPIO_INPUT_H */
@@ -0,0 +1,251 @@
+/*
+ * GPIO level snapshot interface of the gpio-ok0x devices
+ *
+ * read() on any of the devices returns one struct gpio_levels with the
+ * current GPLEV0/GPLEV1 contents, bit n of lev[0] being GPIO n and bit n
+ * of lev[1] GPIO 32 + n.  Every read() takes a fresh snapshot, so the
+ * device never reaches end of file; use one read() per snapshot.
+ * (Receiving gpio-ok05 channels return their decoded text instead.)
+ *
+ * The ioctls return the same levels filtered by a mask, or the levels
+ * together with all six GPFSEL registers as one consistent state.
+ *
+ * GPIO_IOC_PROFILE applies a whole pin configuration at once, on the
+ * devices built on gpio-bcm.h: pulls first (one GPPUD sequence per pull
+ * state), then the output latches (one GPSET and one GPCLR per bank) so
+ * that new outputs come up at their initial level, then every GPFSEL
+ * register that changes, each written once.  The whole profile is
+ * applied under gpio_bcm_lock, so no other GPFSEL or pull update of the
+ * gpio-bcm.h drivers lands in between.
+ */
+#ifndef GPIO_IOCTL_H
+#define GPIO_IOCTL_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/uaccess.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint8_t __u8;
+typedef uint32_t __u32;
+#endif
+
+#define GPIO_IOC_BANKS 2
+#define GPIO_IOC_FSEL_REGS 6
+#define GPIO_IOC_PINS 54
+
+/* gpio_profile.pull / .level entry that leaves the pin as it is */
+#define GPIO_PROFILE_KEEP 0xFF
+
+struct gpio_levels {
+	__u32 lev[GPIO_IOC_BANKS];
+};
+
+struct gpio_levels_masked {
+	/* in: pins of interest */
+	__u32 mask[GPIO_IOC_BANKS];
+	/* out: their levels, 0 for pins outside of the mask */
+	__u32 lev[GPIO_IOC_BANKS];
+};
+
+struct gpio_state {
+	__u32 lev[GPIO_IOC_BANKS];
+	/* GPFSEL0-5, 3 bits per pin, 10 pins per register */
+	__u32 fsel[GPIO_IOC_FSEL_REGS];
+};
+
+/* configuration of the pins set in mask, indexed by pin number */
+struct gpio_profile {
+	__u32 mask[GPIO_IOC_BANKS];
+	/* function select, 0-7 as in GPFSEL */
+	__u8 mode[GPIO_IOC_PINS];
+	/* 0 off, 1 down, 2 up as in GPPUD, or GPIO_PROFILE_KEEP */
+	__u8 pull[GPIO_IOC_PINS];
+	/* output latch 0 or 1, or GPIO_PROFILE_KEEP */
+	__u8 level[GPIO_IOC_PINS];
+	__u8 reserved[2];
+};
+
+#define GPIO_IOC_MAGIC 'g'
+#define GPIO_IOC_LEVELS _IOR(GPIO_IOC_MAGIC, 1, struct gpio_levels)
+#define GPIO_IOC_LEVELS_MASKED _IOWR(GPIO_IOC_MAGIC, 2, struct gpio_levels_masked)
+#define GPIO_IOC_STATE _IOR(GPIO_IOC_MAGIC, 3, struct gpio_state)
+#define GPIO_IOC_PROFILE _IOW(GPIO_IOC_MAGIC, 4, struct gpio_profile)
+
+
+#ifdef __KERNEL__
+
+/*
+ * Register reads of the handlers.  Drivers built on gpio-bcm.h go through
+ * its gpio_read_reg() (and so work on the simulated backend, gpio may be
+ * NULL), the others hand in their GPIO base address.
+ */
+#ifdef GPIO_BCM_H
+#define GPIO_IOC_REG(gpio, offset) gpio_read_reg(offset)
+#else
+#define GPIO_IOC_REG(gpio, offset) ((gpio)[(offset) / sizeof(unsigned int)])
+#endif
+
+/* GPLEV0 and GPFSEL0 offsets */
+#define GPIO_IOC_LEV 0x34
+#define GPIO_IOC_FSEL 0x00
+
+static inline void gpio_ioc_levels(volatile unsigned int *gpio, __u32 *lev)
+{
+	lev[0] = GPIO_IOC_REG(gpio, GPIO_IOC_LEV);
+	lev[1] = GPIO_IOC_REG(gpio, GPIO_IOC_LEV + 4);
+}
+
+/*
+ * levels and function selects as of one instant
+ * The registers cannot be read at once, so read the function selects
+ * around the levels and retry until nobody changed them in between.
+ */
+static inline void gpio_ioc_state(volatile unsigned int *gpio, struct gpio_state *st)
+{
+	unsigned int i;
+	bool stable;
+
+	for (i = 0; i < GPIO_IOC_FSEL_REGS; i++) {
+		st->fsel[i] = GPIO_IOC_REG(gpio, GPIO_IOC_FSEL + i * 4);
+	}
+	do {
+		gpio_ioc_levels(gpio, st->lev);
+		stable = true;
+		for (i = 0; i < GPIO_IOC_FSEL_REGS; i++) {
+			__u32 fsel = GPIO_IOC_REG(gpio, GPIO_IOC_FSEL + i * 4);
+
+			if (fsel != st->fsel[i]) {
+				st->fsel[i] = fsel;
+				stable = false;
+			}
+		}
+	} while (!stable);
+}
+
+/* read() handler body: one snapshot per call */
+static inline ssize_t gpio_ioc_read(volatile unsigned int *gpio,
+				    char __user *buf, size_t count)
+{
+	struct gpio_levels snap;
+
+	if (count < sizeof(snap)) {
+		return -EINVAL;
+	}
+	gpio_ioc_levels(gpio, snap.lev);
+	if (copy_to_user(buf, &snap, sizeof(snap))) {
+		return -EFAULT;
+	}
+	return sizeof(snap);
+}
+
+#ifdef GPIO_BCM_H
+/* apply prof; at most 6 GPFSEL stores plus one set/clear pair per bank */
+static inline int gpio_ioc_profile(const struct gpio_profile *prof)
+{
+	unsigned int pull_mask[PULL_STATES][GPIO_BANKS] = { { 0 } };
+	unsigned int set[GPIO_BANKS] = { 0 }, clr[GPIO_BANKS] = { 0 };
+	unsigned int old[GPIO_IOC_FSEL_REGS], fsel[GPIO_IOC_FSEL_REGS];
+	unsigned int pin, bank, bit, i;
+	unsigned long flags;
+
+	for (pin = 0; pin < GPIO_IOC_PINS; pin++) {
+		if (!(prof->mask[pin / 32] & (1U << (pin % 32)))) {
+			continue;
+		}
+		if (prof->mode[pin] > 7 ||
+		    (prof->pull[pin] >= PULL_STATES && prof->pull[pin] != GPIO_PROFILE_KEEP) ||
+		    (prof->level[pin] > 1 && prof->level[pin] != GPIO_PROFILE_KEEP)) {
+			return -EINVAL;
+		}
+	}
+	if (prof->mask[1] & ~((1U << (GPIO_IOC_PINS - 32)) - 1)) {
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&gpio_bcm_lock, flags);
+	for (i = 0; i < GPIO_IOC_FSEL_REGS; i++) {
+		old[i] = fsel[i] = gpio_read_reg(GPFSEL0 + i * 4);
+	}
+
+	for (pin = 0; pin < GPIO_IOC_PINS; pin++) {
+		bank = pin / 32;
+		bit = 1U << (pin % 32);
+		if (!(prof->mask[bank] & bit)) {
+			continue;
+		}
+		if (prof->pull[pin] != GPIO_PROFILE_KEEP) {
+			pull_mask[prof->pull[pin]][bank] |= bit;
+		}
+		if (prof->level[pin] == 1) {
+			set[bank] |= bit;
+		} else if (prof->level[pin] == 0) {
+			clr[bank] |= bit;
+		}
+		fsel[pin / 10] &= ~(0x07 << ((pin % 10) * 3));
+		fsel[pin / 10] |= prof->mode[pin] << ((pin % 10) * 3);
+	}
+
+	for (i = 0; i < PULL_STATES; i++) {
+		gpio_pull_apply(i, pull_mask[i]);
+	}
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		gpio_set_mask(bank, set[bank]);
+		gpio_clr_mask(bank, clr[bank]);
+	}
+	for (i = 0; i < GPIO_IOC_FSEL_REGS; i++) {
+		if (fsel[i] != old[i]) {
+			gpio_write_reg(GPFSEL0 + i * 4, fsel[i]);
+		}
+	}
+	spin_unlock_irqrestore(&gpio_bcm_lock, flags);
+	return 0;
+}
+#endif
+
+/* unlocked_ioctl handler body for the GPIO_IOC_* commands */
+static inline long gpio_ioc_ioctl(volatile unsigned int *gpio,
+				  unsigned int cmd, unsigned long arg)
+{
+	void __user *uarg = (void __user *)arg;
+	struct gpio_levels snap;
+	struct gpio_levels_masked masked;
+	struct gpio_state st;
+#ifdef GPIO_BCM_H
+	struct gpio_profile prof;
+#endif
+
+	switch (cmd) {
+	case GPIO_IOC_LEVELS:
+		gpio_ioc_levels(gpio, snap.lev);
+		return copy_to_user(uarg, &snap, sizeof(snap)) ? -EFAULT : 0;
+
+	case GPIO_IOC_LEVELS_MASKED:
+		if (copy_from_user(&masked, uarg, sizeof(masked))) {
+			return -EFAULT;
+		}
+		gpio_ioc_levels(gpio, masked.lev);
+		masked.lev[0] &= masked.mask[0];
+		masked.lev[1] &= masked.mask[1];
+		return copy_to_user(uarg, &masked, sizeof(masked)) ? -EFAULT : 0;
+
+	case GPIO_IOC_STATE:
+		gpio_ioc_state(gpio, &st);
+		return copy_to_user(uarg, &st, sizeof(st)) ? -EFAULT : 0;
+
+#ifdef GPIO_BCM_H
+	case GPIO_IOC_PROFILE:
+		if (copy_from_user(&prof, uarg, sizeof(prof))) {
+			return -EFAULT;
+		}
+		return gpio_ioc_profile(&prof);
+#endif
+	}
+	return -ENOTTY;
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* GPIO_IOCTL_H */
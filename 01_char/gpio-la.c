@@ -0,0 +1,412 @@
+/*
+ * GPIO-LA - logic analyzer on all 54 GPIO pins
+ *
+ * A kernel thread, optionally bound to one CPU and run as SCHED_FIFO,
+ * reads GPLEV0/GPLEV1 on absolute System Timer deadlines (or back to
+ * back with rate 0).  Consecutive identical samples are merged into one
+ * 16 byte run record, so a capture costs memory per transition rather
+ * than per sample: a 64 MB buffer holds about four million edges however
+ * long the lines sit still in between.
+ *
+ * The buffer is a struct gpio_la_header followed by the runs (see
+ * gpio-la.h) and can be read() or mmap()ed read-only, also while the
+ * capture is still running; only committed runs are counted in the
+ * header, which is updated under its seq count.
+ *
+ *   insmod gpio-la.ko buf_mb=64 cpu=3
+ *   mknod /dev/gpio-la c 233 0
+ *
+ * The System Timer ticks in microseconds, so rates above 1 MHz are paced
+ * in bursts; run timestamps stay exact to the microsecond either way.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+
+#include "gpio-bcm.h"
+#include "gpio-la.h"
+
+/*
+ * Debug option
+ */
+#define GPIO_LA_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef GPIO_LA_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[GPIO-LA] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module major number */
+static int DEV_LA_MAJOR_NUMBER = 233;
+/* Module name */
+#define DEV_LA_NAME "gpio-la"
+
+/* GPIO 32-53 in GPLEV1 */
+#define LA_BANK1_MASK ((1U << (GPIO_MAX_PIN - 31)) - 1)
+
+/* publish the sample count and let the scheduler in every 64k samples */
+#define LA_YIELD_MASK 0xFFFF
+
+static unsigned int buf_mb = 64;
+module_param(buf_mb, uint, 0444);
+MODULE_PARM_DESC(buf_mb, "Capture buffer size in MB");
+
+static int cpu = -1;
+module_param(cpu, int, 0444);
+MODULE_PARM_DESC(cpu, "CPU the sampling thread is bound to and run SCHED_FIFO on, -1 for any");
+
+struct la {
+	/* serializes start/stop */
+	struct mutex lock;
+	void *buf;
+	size_t size;
+	struct gpio_la_header *hdr;
+	struct gpio_la_run *runs;
+	u64 max_runs;
+	/* runs readers may look at, a native word for acquire/release */
+	unsigned long committed;
+	struct task_struct *thread;
+	u64 max_samples;
+};
+
+static struct la la_dev;
+
+
+/* open and close an update of the header, see gpio-la.h */
+static void la_hdr_begin(struct gpio_la_header *hdr)
+{
+	WRITE_ONCE(hdr->seq, hdr->seq + 1);
+	smp_wmb();
+}
+
+static void la_hdr_end(struct gpio_la_header *hdr)
+{
+	smp_wmb();
+	WRITE_ONCE(hdr->seq, hdr->seq + 1);
+}
+
+/* consistent copy of the header */
+static void la_hdr_snapshot(const struct gpio_la_header *hdr,
+			    struct gpio_la_header *snap)
+{
+	u32 seq;
+
+	do {
+		seq = READ_ONCE(hdr->seq);
+		smp_rmb();
+		memcpy(snap, hdr, sizeof(*snap));
+		smp_rmb();
+	} while ((seq & 1) || seq != READ_ONCE(hdr->seq));
+}
+
+
+/* spin until the System Timer passes deadline, false if asked to stop */
+static bool la_wait(u64 deadline_ns)
+{
+	while (get_time_stamp() * NSEC_PER_USEC < deadline_ns) {
+		if (kthread_should_stop()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int la_thread(void *data)
+{
+	struct la *la = data;
+	struct gpio_la_header *hdr = la->hdr;
+	u64 period_ns = hdr->rate_hz ? NSEC_PER_SEC / hdr->rate_hz : 0;
+	u64 next_ns, samples = 1, nruns = 0;
+	struct gpio_la_run cur;
+	unsigned int l0, l1, overflow = 0;
+
+	la_hdr_begin(hdr);
+	hdr->start_us = get_time_stamp();
+	la_hdr_end(hdr);
+	next_ns = hdr->start_us * NSEC_PER_USEC;
+	cur.lev[0] = gpio_get_levels(0);
+	cur.lev[1] = gpio_get_levels(1) & LA_BANK1_MASK;
+	cur.start_us = (u32)hdr->start_us;
+	cur.samples = 1;
+
+	while (!kthread_should_stop()) {
+		if (la->max_samples && samples >= la->max_samples) {
+			break;
+		}
+		if (period_ns) {
+			next_ns += period_ns;
+			if (!la_wait(next_ns)) {
+				break;
+			}
+		}
+
+		l0 = gpio_get_levels(0);
+		l1 = gpio_get_levels(1) & LA_BANK1_MASK;
+		if (l0 == cur.lev[0] && l1 == cur.lev[1] && cur.samples != U32_MAX) {
+			cur.samples++;
+		} else {
+			/* the last slot is kept for the run still open */
+			if (nruns + 1 >= la->max_runs) {
+				overflow = GPIO_LA_OVERFLOW;
+				break;
+			}
+			la->runs[nruns] = cur;
+			la_hdr_begin(hdr);
+			hdr->runs = ++nruns;
+			la_hdr_end(hdr);
+			smp_store_release(&la->committed, nruns);
+
+			cur.lev[0] = l0;
+			cur.lev[1] = l1;
+			cur.start_us = (u32)get_time_stamp();
+			cur.samples = 1;
+		}
+
+		if ((++samples & LA_YIELD_MASK) == 0) {
+			la_hdr_begin(hdr);
+			hdr->samples = samples;
+			la_hdr_end(hdr);
+			cond_resched();
+		}
+	}
+
+	la->runs[nruns] = cur;
+	la_hdr_begin(hdr);
+	hdr->end_us = get_time_stamp();
+	hdr->samples = samples;
+	hdr->runs = nruns + 1;
+	hdr->flags = (hdr->flags & ~GPIO_LA_RUNNING) | overflow;
+	la_hdr_end(hdr);
+	smp_store_release(&la->committed, nruns + 1);
+	PDEBUG("%llu samples in %llu runs over %llu us\n",
+	       samples, nruns + 1, hdr->end_us - hdr->start_us);
+
+	/* done capturing, park until la_stop() reaps us */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			break;
+		}
+		schedule();
+	}
+	return 0;
+}
+
+static void la_stop(struct la *la)
+{
+	if (la->thread) {
+		kthread_stop(la->thread);
+		la->thread = NULL;
+	}
+}
+
+static int la_start(struct la *la, const struct gpio_la_config *cfg)
+{
+	struct gpio_la_header *hdr = la->hdr;
+	struct task_struct *t;
+
+	la_stop(la);
+
+	la_hdr_begin(hdr);
+	memset(hdr, 0, offsetof(struct gpio_la_header, seq));
+	hdr->magic = GPIO_LA_MAGIC;
+	hdr->version = GPIO_LA_VERSION;
+	hdr->rate_hz = cfg->rate_hz;
+	hdr->flags = GPIO_LA_RUNNING;
+	la->committed = 0;
+	la->max_samples = cfg->max_samples;
+
+	t = kthread_create(la_thread, la, "gpio-la");
+	if (IS_ERR(t)) {
+		hdr->flags = 0;
+		la_hdr_end(hdr);
+		return PTR_ERR(t);
+	}
+	la_hdr_end(hdr);
+	if (cpu >= 0) {
+		kthread_bind(t, cpu);
+		sched_set_fifo(t);
+	}
+	la->thread = t;
+	wake_up_process(t);
+	return 0;
+}
+
+/* bytes of the buffer that hold committed data */
+static size_t la_avail(struct la *la)
+{
+	return sizeof(struct gpio_la_header) +
+	       smp_load_acquire(&la->committed) * sizeof(struct gpio_la_run);
+}
+
+
+static int la_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = &la_dev;
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static int la_release(struct inode *inode, struct file *filp)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static ssize_t la_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct la *la = filp->private_data;
+	struct gpio_la_header hdr;
+	size_t avail, done = 0;
+
+	/* the header comes from a snapshot, the runs it counts are committed */
+	if (*f_pos < sizeof(hdr)) {
+		la_hdr_snapshot(la->hdr, &hdr);
+		avail = sizeof(hdr) + hdr.runs * sizeof(struct gpio_la_run);
+	} else {
+		avail = la_avail(la);
+	}
+	if (*f_pos >= avail) {
+		return 0;
+	}
+	count = min_t(size_t, count, avail - *f_pos);
+	if (*f_pos < sizeof(hdr)) {
+		done = min_t(size_t, count, sizeof(hdr) - *f_pos);
+		if (copy_to_user(buf, (u8 *)&hdr + *f_pos, done)) {
+			return -EFAULT;
+		}
+	}
+	if (copy_to_user(buf + done, (u8 *)la->buf + *f_pos + done, count - done)) {
+		return -EFAULT;
+	}
+	*f_pos += count;
+	return count;
+}
+
+static int la_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct la *la = filp->private_data;
+
+	if (vma->vm_flags & VM_WRITE) {
+		return -EPERM;
+	}
+	/* and no mprotect() to writable later */
+	vm_flags_clear(vma, VM_MAYWRITE);
+	return remap_vmalloc_range(vma, la->buf, vma->vm_pgoff);
+}
+
+static long la_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct la *la = filp->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct gpio_la_config cfg;
+	struct gpio_la_header hdr;
+	long ret = 0;
+
+	if (mutex_lock_interruptible(&la->lock)) {
+		return -ERESTARTSYS;
+	}
+
+	switch (cmd) {
+	case GPIO_LA_IOC_START:
+		if (copy_from_user(&cfg, uarg, sizeof(cfg))) {
+			ret = -EFAULT;
+		} else {
+			ret = la_start(la, &cfg);
+		}
+		break;
+
+	case GPIO_LA_IOC_STOP:
+		la_stop(la);
+		break;
+
+	case GPIO_LA_IOC_STATUS:
+		la_hdr_snapshot(la->hdr, &hdr);
+		if (copy_to_user(uarg, &hdr, sizeof(hdr))) {
+			ret = -EFAULT;
+		}
+		break;
+
+	default:
+		ret = -ENOTTY;
+	}
+
+	mutex_unlock(&la->lock);
+	return ret;
+}
+
+static struct file_operations la_fops = {
+	.owner = THIS_MODULE,
+	.open = la_open,
+	.release = la_release,
+	.read = la_read,
+	.mmap = la_mmap,
+	.unlocked_ioctl = la_ioctl
+};
+
+
+static int gpio_la_init(void)
+{
+	struct la *la = &la_dev;
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	/* registers are mapped by gpio-bcm */
+	if (gpio_bcm_ready()) {
+		return -ENODEV;
+	}
+
+	if (cpu >= (int)nr_cpu_ids || buf_mb == 0) {
+		return -EINVAL;
+	}
+
+	la->size = (size_t)buf_mb << 20;
+	la->buf = vmalloc_user(la->size);
+	if (!la->buf) {
+		return -ENOMEM;
+	}
+	la->hdr = la->buf;
+	la->hdr->magic = GPIO_LA_MAGIC;
+	la->hdr->version = GPIO_LA_VERSION;
+	la->runs = (struct gpio_la_run *)(la->hdr + 1);
+	la->max_runs = (la->size - sizeof(struct gpio_la_header)) / sizeof(struct gpio_la_run);
+	mutex_init(&la->lock);
+
+	ret = register_chrdev(DEV_LA_MAJOR_NUMBER, DEV_LA_NAME, &la_fops);
+	if (ret < 0) {
+		vfree(la->buf);
+		return ret;
+	}
+	return 0;
+}
+
+static void gpio_la_exit(void)
+{
+	struct la *la = &la_dev;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	unregister_chrdev(DEV_LA_MAJOR_NUMBER, DEV_LA_NAME);
+	la_stop(la);
+	vfree(la->buf);
+}
+
+
+module_init(gpio_la_init);
+module_exit(gpio_la_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Run-length compressed logic analyzer on BCM2837 GPIO");
@@ -0,0 +1,74 @@
+/*
+ * GPIO-LA capture format and ioctl interface
+ *
+ * The capture buffer, as returned by read() from offset 0 or mapped with
+ * mmap(), is one struct gpio_la_header followed by header.runs records of
+ * struct gpio_la_run.  Each run is a level snapshot of all 54 pins that
+ * stayed unchanged for samples consecutive samples.
+ *
+ * While a capture runs the header changes under the reader.  header.seq
+ * is odd while the driver updates it, so a reader of the mapping copies
+ * the header between two reads of seq and retries while seq was odd or
+ * changed.  The runs the copy counts are complete.  read() and
+ * GPIO_LA_IOC_STATUS do the same and always return a consistent header.
+ */
+#ifndef GPIO_LA_H
+#define GPIO_LA_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+#endif
+
+#define GPIO_LA_MAGIC 0x414C5047 /* "GPLA" */
+#define GPIO_LA_VERSION 2
+
+/* header.flags */
+#define GPIO_LA_RUNNING 0x01
+/* capture stopped because the buffer was full */
+#define GPIO_LA_OVERFLOW 0x02
+
+struct gpio_la_header {
+	__u32 magic;
+	__u32 version;
+	/* requested sample rate, 0 for free running */
+	__u32 rate_hz;
+	__u32 flags;
+	/* System Timer at the first sample, microseconds */
+	__u64 start_us;
+	/* System Timer at the last sample, microseconds */
+	__u64 end_us;
+	__u64 samples;
+	__u64 runs;
+	/* odd while the header is being updated */
+	__u32 seq;
+	__u32 reserved;
+};
+
+struct gpio_la_run {
+	/* GPLEV0 and GPLEV1 */
+	__u32 lev[2];
+	/* low 32 bits of the System Timer at the first sample of the run */
+	__u32 start_us;
+	__u32 samples;
+};
+
+struct gpio_la_config {
+	/* 0 samples as fast as the register reads go */
+	__u32 rate_hz;
+	__u32 reserved;
+	/* stop after this many samples, 0 for until full or stopped */
+	__u64 max_samples;
+};
+
+#define GPIO_LA_IOC_MAGIC 'l'
+#define GPIO_LA_IOC_START _IOW(GPIO_LA_IOC_MAGIC, 1, struct gpio_la_config)
+#define GPIO_LA_IOC_STOP _IO(GPIO_LA_IOC_MAGIC, 2)
+#define GPIO_LA_IOC_STATUS _IOR(GPIO_LA_IOC_MAGIC, 3, struct gpio_la_header)
+
+#endif /* GPIO_LA_H */
@@ -6,6 +6,8 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 
+#include "gpio-ioctl.h"
+
 /*
  * Debug option
  */
@@ -155,10 +157,10 @@ static int ok01_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/* one snapshot of all pin levels, see gpio-ioctl.h */
 static ssize_t ok01_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
 {
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
-	return 0;
+	return gpio_ioc_read(get_gpio_addr(), buf, count);
 }
 
 static ssize_t ok01_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
@@ -167,13 +169,18 @@ static ssize_t ok01_write(struct file *filp, const char __user *buf, size_t coun
 	return 0;
 }
 
+static long ok01_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	return gpio_ioc_ioctl(get_gpio_addr(), cmd, arg);
+}
 
 static struct file_operations ok01_fops = {
 	.owner = THIS_MODULE,
 	.open = ok01_open,
 	.release = ok01_release,
 	.read = ok01_read,
-	.write = ok01_write
+	.write = ok01_write,
+	.unlocked_ioctl = ok01_ioctl
 };
 
 static int ok01_init(void)
@@ -4,6 +4,8 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 
+#include "gpio-ioctl.h"
+
 /*
  * Debug option
  */
@@ -174,10 +176,10 @@ static int ok02_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/* one snapshot of all pin levels, see gpio-ioctl.h */
 static ssize_t ok02_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
 {
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
-	return 0;
+	return gpio_ioc_read(get_gpio_addr(), buf, count);
 }
 
 static ssize_t ok02_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
@@ -186,13 +188,18 @@ static ssize_t ok02_write(struct file *filp, const char __user *buf, size_t coun
 	return 0;
 }
 
+static long ok02_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	return gpio_ioc_ioctl(get_gpio_addr(), cmd, arg);
+}
+
 static struct file_operations ok02_fops = {
 	.owner = THIS_MODULE,
 	.open = ok02_open,
 	.release = ok02_release,
 	.read = ok02_read,
 	.write = ok02_write,
-	//.ioctl = ok02_ioctl
+	.unlocked_ioctl = ok02_ioctl
 };
 
 static int ok02_init(void)
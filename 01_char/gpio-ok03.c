@@ -3,6 +3,8 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 
+#include "gpio-ioctl.h"
+
 
 /*
  * Debug option
@@ -187,10 +189,10 @@ static int ok03_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/* one snapshot of all pin levels, see gpio-ioctl.h */
 static ssize_t ok03_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
 {
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);	
-	return 0;
+	return gpio_ioc_read(get_gpio_addr(), buf, count);
 }
 
 static ssize_t ok03_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
@@ -199,12 +201,18 @@ static ssize_t ok03_write(struct file *filp, const char __user *buf, size_t coun
 	return 0;
 }
 
+static long ok03_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	return gpio_ioc_ioctl(get_gpio_addr(), cmd, arg);
+}
+
 static struct file_operations ok03_fops = {
 	.owner = THIS_MODULE,
 	.open = ok03_open,
 	.release = ok03_release,
 	.read = ok03_read,
-	.write = ok03_write
+	.write = ok03_write,
+	.unlocked_ioctl = ok03_ioctl
 };
 
 static int ok03_init(void)
@@ -3,6 +3,8 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 
+#include "gpio-ioctl.h"
+
 
 /*
  * Debug option
@@ -222,10 +224,10 @@ static int ok04_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/* one snapshot of all pin levels, see gpio-ioctl.h */
 static ssize_t ok04_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
 {
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);	
-	return 0;
+	return gpio_ioc_read(get_gpio_addr(), buf, count);
 }
 
 static ssize_t ok04_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
@@ -234,13 +236,18 @@ static ssize_t ok04_write(struct file *filp, const char __user *buf, size_t coun
 	return 0;
 }
 
+static long ok04_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	return gpio_ioc_ioctl(get_gpio_addr(), cmd, arg);
+}
 
 static struct file_operations ok04_fops = {
 	.owner = THIS_MODULE,
 	.open = ok04_open,
 	.release = ok04_release,
 	.read = ok04_read,
-	.write = ok04_write
+	.write = ok04_write,
+	.unlocked_ioctl = ok04_ioctl
 };
 
 static int ok04_init(void)
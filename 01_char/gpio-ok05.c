@@ -1,9 +1,71 @@
+/*
+ * GPIO-OK05 - Morse code on one or more LEDs
+ *
+ * Every pin in pins= is a channel, opened through the minor of the same
+ * index, so several messages can be sent at once:
+ *
+ *   insmod gpio-ok05.ko pins=16,20,21
+ *   mknod /dev/gpio-ok05 c 225 0
+ *   mknod /dev/gpio-ok05-1 c 225 1
+ *
+ * write() only queues: each character becomes dot/dash elements on the
+ * channel's queue and returns, fsync() waits until the channel is done.
+ * Writers that already have the symbols can switch their open file to
+ * packed dots, dashes and gaps with GPIO_OK05_IOC_FORMAT, see gpio-ok05.h,
+ * which go to the queue without any text parsing.
+ *
+ * Channels can also receive: the pin in rx_pins= of the same index is an
+ * input whose edge interrupts are timestamped with the System Timer.
+ * Marks (high) and the spaces between them are classified against an
+ * estimate of the dot length that follows the sender's speed, and each
+ * character is looked up when the line stays low long enough to end it.
+ * read() on such a channel returns the decoded text instead of the
+ * level snapshot of gpio-ioctl.h:
+ *
+ *   insmod gpio-ok05.ko pins=16,20 rx_pins=17,27 gpio_base=512
+ *
+ * gpio_base is where the SoC GPIO chip starts in the kernel numbering,
+ * as for gpio-input.  Nothing is polled, so receiving costs one short
+ * IRQ per edge and channel.
+ *
+ * A single hrtimer plays all channels.  Edges are placed on a grid of
+ * Morse units shared by every channel, the channels are kept in a
+ * min-heap on the tick of their next edge, and each expiry takes every
+ * channel due at that tick off the heap and stores all their edges with
+ * one GPSET and one GPCLR per bank.  So the timer runs at most once per
+ * unit however many channels blink, and the CPU cost grows with the
+ * heap (log of the channels), not with the edges.
+ *
+ * Built with GPIO_BCM_SIMULATE, bench_chars sends that many characters
+ * on 1, 8 and 32 channels at load and reports the timer cost of each:
+ *
+ *   insmod gpio-ok05.ko unit_us=200 bench_chars=100
+ *
+ * and bench_ingest times writing that many characters to a channel's
+ * queue as text and as packed symbols, without playing them.  There are
+ * no IRQs in the simulator; bench_decode instead feeds that many
+ * characters of synthetic, jittered edge timestamps at several speeds
+ * through the receive decoder.
+ */
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/types.h>		/* size_t, loff_t */
-#include <asm/uacess.h>			/* get_user() */
+#include <linux/uaccess.h>		/* get_user() */
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+
+#include "gpio-bcm.h"
+#include "gpio-ioctl.h"
+#include "gpio-ok05.h"
 
 /*
  * Debug option
@@ -27,197 +89,637 @@ static int DEV_OK05_MAJOR_NUMBER = 225;
 #define DEV_OK05_NAME "gpio-ok05"
 
 
-/* Macro for function select (mode)
- * 000 : input
- * 001 : output
- * 100 : alternate function 0
- * 101 : alternate function 1
- * 110 : alternate function 2
- * 111 : alternate function 3
- * 011 : alternate function 4
- * 010 : alternate function 5
+/* default Morse unit: a dot, and the gap between elements */
+#define MORSE_DELAY 250000
+
+/* default channel */
+#define CUR_GPIO 16
+
+#define MORSE_MAX_CHANNELS 32
+
+/* queued elements per channel, must be a power of two */
+#define MORSE_FIFO 1024
+
+/*
+ * An element is a mark of on units followed by off units of silence,
+ * on in the high nibble.  Dots and dashes are followed by one unit, the
+ * last one of a character by three, and a space adds four more.
  */
-#define M_INPUT 0
-#define M_OUTPUT 1
+#define MORSE_ELEM(on, off) (((on) << 4) | (off))
+#define MORSE_ON(el) ((el) >> 4)
+#define MORSE_OFF(el) ((el) & 0x0F)
+#define MORSE_DOT MORSE_ELEM(1, 1)
+#define MORSE_DASH MORSE_ELEM(3, 1)
+#define MORSE_CHAR_GAP 3
+#define MORSE_WORD MORSE_ELEM(0, 4)
 
-/* Macro for GPIO status */
-#define S_LOW 0
-#define S_HIGH 1
+/* longest code, 5 for the digits */
+#define MORSE_MAX_ELEMS 6
 
-/* LED status */
-#define S_OFF 0
-#define S_ON 1
+/*
+ * packed bytes taken from the user at a time; their elements are queued
+ * together, so must not need more than the half queue writers wait for
+ */
+#define MORSE_PACKED_CHUNK 64
 
-#define MORSE_DELAY 250000
+/* decoded characters per receiving channel, must be a power of two */
+#define MORSE_RX_FIFO 256
 
-/* controlled GPIO */
-#define CUR_GPIO 16
+/*
+ * marks from MORSE_RX_DASH dots on are dashes.  Space thresholds in
+ * dots: below MORSE_RX_CHAR the character goes on,
+ * from MORSE_RX_WORD a word ended.  A character is looked up once the
+ * line stayed low for MORSE_RX_FLUSH dots.
+ */
+#define MORSE_RX_DASH 2
+#define MORSE_RX_CHAR 2
+#define MORSE_RX_FLUSH 3
+#define MORSE_RX_WORD 5
+
+static unsigned int pins[MORSE_MAX_CHANNELS] = { CUR_GPIO };
+static unsigned int npins = 1;
+module_param_array(pins, uint, &npins, 0444);
+MODULE_PARM_DESC(pins, "LED of each channel, the channel is the minor number");
+
+static unsigned int unit_us = MORSE_DELAY;
+module_param(unit_us, uint, 0444);
+MODULE_PARM_DESC(unit_us, "Morse unit (dot length) in microseconds");
+
+static unsigned int rx_pins[MORSE_MAX_CHANNELS];
+static unsigned int nrx;
+module_param_array(rx_pins, uint, &nrx, 0444);
+MODULE_PARM_DESC(rx_pins, "Input of each receiving channel, in the order of pins");
+
+static unsigned int gpio_base;
+module_param(gpio_base, uint, 0444);
+MODULE_PARM_DESC(gpio_base, "Kernel GPIO number of BCM pin 0");
+
+#ifdef GPIO_BCM_SIMULATE
+static unsigned int bench_chars;
+module_param(bench_chars, uint, 0444);
+MODULE_PARM_DESC(bench_chars, "Send this many characters on 1, 8 and 32 channels at load");
+
+static unsigned int bench_ingest;
+module_param(bench_ingest, uint, 0444);
+MODULE_PARM_DESC(bench_ingest, "Queue this many characters as text and as packed symbols at load");
+
+static unsigned int bench_decode;
+module_param(bench_decode, uint, 0444);
+MODULE_PARM_DESC(bench_decode, "Decode this many characters of synthetic edges at load");
+#endif
+
+static const char *const morse_digits[10] = {
+	"-----", ".----", "..---", "...--", "....-",
+	".....", "-....", "--...", "---..", "----.",
+};
+
+static const char *const morse_alpha[26] = {
+	".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..",
+	".---", "-.-", ".-..", "--", "-.", "---", ".--.", "--.-", ".-.",
+	"...", "-", "..-", "...-", ".--", "-..-", "-.--", "--..",
+};
+
+struct morse_chan {
+	unsigned int pin;
+	unsigned int bank;
+	unsigned int bit;
+	DECLARE_KFIFO(fifo, u8, MORSE_FIFO);
+	/* writers waiting for room, fsync() waiting for the end */
+	wait_queue_head_t wait;
+	/* on the heap, playing */
+	bool active;
+	/* LED on, the current element's off units still to come */
+	bool mark;
+	u8 off;
+	/* tick of the next edge */
+	u64 next;
+};
+
+/* adaptive decoder of one receiving channel */
+struct morse_decoder {
+	/* dot length estimate, us */
+	u32 dot_us;
+	/* marks of the current character, a dash is a 1, the first one lowest */
+	u32 code;
+	u32 len;
+	/* a character was decoded since the last space */
+	bool word;
+	/* statistics */
+	u64 marks;
+	u64 chars;
+	u64 errors;
+};
+
+struct morse_rx {
+	unsigned int pin;
+	int irq;
+	/* protects the decoder and the line state */
+	spinlock_t lock;
+	/* level and System Timer time of the last edge */
+	int level;
+	u64 last_us;
+	struct morse_decoder dec;
+	/* looks the character up once the line stays low */
+	struct hrtimer flush;
+	DECLARE_KFIFO(text, char, MORSE_RX_FIFO);
+	/* serializes readers against each other */
+	struct mutex read_lock;
+	wait_queue_head_t wait;
+	u64 dropped;
+};
+
+struct morse {
+	/* protects the channels, the heap and the statistics */
+	spinlock_t lock;
+	struct morse_chan ch[MORSE_MAX_CHANNELS];
+	unsigned int nch;
+	/* active channels by index, min-heap on next */
+	unsigned int heap[MORSE_MAX_CHANNELS];
+	unsigned int nheap;
+	wait_queue_head_t idle;
+	struct hrtimer timer;
+	/* tick n is at epoch_ns + n * unit_ns */
+	u64 epoch_ns;
+	u64 unit_ns;
+	/* statistics */
+	u64 expiries;
+	u64 edges;
+	u64 stores;
+	u64 busy_ns;
+	struct morse_rx rx[MORSE_MAX_CHANNELS];
+	unsigned int nrx;
+};
+
+static struct morse morse_dev;
 
-/* I/O base address on the virtual memory in kernel */
-#define BCM2837_PERI_BASE 0xF2000000
+/* character of each received code, indexed by 1 << length | code */
+static char morse_rx_table[1 << MORSE_MAX_ELEMS];
 
-/* GPIO base address on the virtual memory in kernel */
-#define GPIO_BASE (BCM2837_PERI_BASE + 0x00200000)
+/* one open() of a channel */
+struct ok05_file {
+	struct morse_chan *c;
+	/* the receiving side, NULL if the channel has no input */
+	struct morse_rx *rx;
+	/* GPIO_OK05_FORMAT_* of write() */
+	unsigned int format;
+	/* packed: the last dot or dash, queued once it is known whether it ends the character */
+	u8 held;
+};
 
-/* System Timer base address on the virtual memory in kernel */
-#define TIMER_BASE (BCM2837_PERI_BASE + 0x00003000)
 
-/* return GPIO base address */
-static volatile unsigned int *get_gpio_addr()
+/* min-heap of the active channels on their next tick */
+static bool morse_before(struct morse *m, unsigned int a, unsigned int b)
 {
-	return (volatile unsigned int *)GPIO_BASE; 
+	return m->ch[m->heap[a]].next < m->ch[m->heap[b]].next;
 }
 
-static int set_bits(volatile unsigned int *addr
-					const unsigned int shift,
-					const unsigned int val,
-					const unsigned int mask)
+static void morse_heap_swap(struct morse *m, unsigned int a, unsigned int b)
 {
-	unsigned int temp = *addr;
+	unsigned int tmp = m->heap[a];
 
-	/* initialize an assigned part */
-	temp &= ~(mask << shift);
+	m->heap[a] = m->heap[b];
+	m->heap[b] = tmp;
+}
 
-	/* set val into addr */
-	temp |= (val & mask) << shift;
-	*addr = temp;
-	
-	return 0;
+static void morse_sift_down(struct morse *m, unsigned int i)
+{
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < m->nheap) {
+		if (child + 1 < m->nheap && morse_before(m, child + 1, child)) {
+			child++;
+		}
+		if (!morse_before(m, child, i)) {
+			break;
+		}
+		morse_heap_swap(m, i, child);
+		i = child;
+	}
+}
+
+static void morse_heap_push(struct morse *m, unsigned int idx)
+{
+	unsigned int i = m->nheap++;
+
+	m->heap[i] = idx;
+	while (i && morse_before(m, i, (i - 1) / 2)) {
+		morse_heap_swap(m, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void morse_heap_pop(struct morse *m)
+{
+	m->heap[0] = m->heap[--m->nheap];
+	morse_sift_down(m, 0);
+}
+
+static ktime_t morse_tick_time(struct morse *m, u64 tick)
+{
+	return ns_to_ktime(m->epoch_ns + tick * m->unit_ns);
 }
 
-/* 
- * assign a function of GPIO 16 to mode
- * Macro for function select (mode)
- * 000 : input
- * 001 : output
- * 100 : alternate function 0
- * 101 : alternate function 1
- * 110 : alternate function 2
- * 111 : alternate function 3
- * 011 : alternate function 4
- * 010 : alternate function 5
+static u64 morse_tick_now(struct morse *m)
+{
+	return div64_u64(ktime_get_ns() - m->epoch_ns, m->unit_ns);
+}
+
+/*
+ * one edge of channel c, due now: add it to the bank masks and work out
+ * the next one; false once its queue ran dry.  m->lock held.
  */
-static int func_pin(const unsigned int pin_num,
-					const unsigned int mode)
-{
-	volatile unsigned int *gpio = get_gpio_addr(); /* return 0xF2200000 */
-	/* we can set 10 gpio function to one register */
-	unsigned int pin_bank = pin_num / 10;
-	
-	/* we can control total 53 gpio */
-	if (pin_num > 53) {
-		return -1;
-	}
-
-	/* one gpio can be reprented by 3 bits */
-	if (mode > 7) {
-		return -1;
-	}
-
-	gpio += pin_bank;
-	
-	/* assign 18~20bit of addr 0xF2200004 to mode */
-	/* basic operation unit is sizeof(unsigned int) */
-	/* access to GPIO 16 after (gpio + 1) */
-	/* shift 0x7 because it is 111b */
-	/* shfit+1, shift+2 set to 1b  */
-	set_bits(gpio, (pin_num % 10) * 3, mode, 0x07);
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
-	
-	return 0;
+static bool morse_step(struct morse *m, struct morse_chan *c,
+		       unsigned int *set, unsigned int *clr)
+{
+	u8 el;
+
+	if (c->mark) {
+		clr[c->bank] |= c->bit;
+		c->mark = false;
+		c->next += c->off;
+		m->edges++;
+		return true;
+	}
+
+	if (!kfifo_get(&c->fifo, &el)) {
+		c->active = false;
+		wake_up_interruptible(&c->wait);
+		return false;
+	}
+	if (kfifo_len(&c->fifo) == MORSE_FIFO / 2) {
+		wake_up_interruptible(&c->wait);
+	}
+
+	c->off = MORSE_OFF(el);
+	if (MORSE_ON(el)) {
+		set[c->bank] |= c->bit;
+		c->mark = true;
+		c->next += MORSE_ON(el);
+		m->edges++;
+	} else {
+		c->next += c->off;
+	}
+	return true;
 }
 
-static int set_pin(const unsigned int pin_num,
-				   const unsigned int status)
+static enum hrtimer_restart morse_timer(struct hrtimer *t)
 {
-	volatile unsigned int *gpio = get_gpio_addr();
-	unsigned int pin_bank = pin_num >> 5;
+	struct morse *m = container_of(t, struct morse, timer);
+	unsigned int set[GPIO_BANKS], clr[GPIO_BANKS], bank;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	u64 start = ktime_get_ns(), now, tick;
+	struct morse_chan *c;
+
+	spin_lock(&m->lock);
+	now = morse_tick_now(m);
+	m->expiries++;
+
+	/* every tick that is due, oldest first; normally just this one */
+	while (m->nheap && (tick = m->ch[m->heap[0]].next) <= now) {
+		memset(set, 0, sizeof(set));
+		memset(clr, 0, sizeof(clr));
+		while (m->nheap && (c = &m->ch[m->heap[0]])->next == tick) {
+			if (morse_step(m, c, set, clr)) {
+				morse_sift_down(m, 0);
+			} else {
+				morse_heap_pop(m);
+			}
+		}
+		for (bank = 0; bank < GPIO_BANKS; bank++) {
+			gpio_set_mask(bank, set[bank]);
+			gpio_clr_mask(bank, clr[bank]);
+			m->stores += !!set[bank] + !!clr[bank];
+		}
+	}
+
+	/* a writer that restarted the timer meanwhile already set the expiry */
+	if (m->nheap && !hrtimer_is_queued(t)) {
+		hrtimer_set_expires(t, morse_tick_time(m, m->ch[m->heap[0]].next));
+		ret = HRTIMER_RESTART;
+	}
+	if (!m->nheap) {
+		wake_up_interruptible(&m->idle);
+	}
+	m->busy_ns += ktime_get_ns() - start;
+	spin_unlock(&m->lock);
+	return ret;
+}
 
-	if (pin_num > 53) {
-		return -1;
+/* put an idle channel on the grid at the next tick; m->lock held */
+static void morse_kick(struct morse *m, struct morse_chan *c)
+{
+	if (c->active) {
+		return;
 	}
+	c->active = true;
+	c->mark = false;
+	c->next = morse_tick_now(m) + 1;
+	morse_heap_push(m, c - m->ch);
 
-	if (status != S_OFF && status != S_ON) {
-		return -1;
+	/* the earliest edge now: move the timer up */
+	if (&m->ch[m->heap[0]] == c) {
+		hrtimer_start(&m->timer, morse_tick_time(m, c->next), HRTIMER_MODE_ABS);
 	}
+}
 
-	gpio += pin_bank;
+/* queue the n elements of one character as a whole */
+static int morse_queue(struct morse *m, struct morse_chan *c,
+		       const u8 *el, unsigned int n, bool nonblock)
+{
+	unsigned long flags;
 
-	if (status == S_OFF) {
-		/* clear output */
-		set_bits(gpio + (0x28/sizeof(unsigned int)), pin_num, S_HIGH, 0x01);
-		set_bits(gpio + (0x28/sizeof(unsigned int)), pin_num, S_LOW, 0x01);
-	} else if (status == S_ON) {
-		/* set output */
-		set_bits(gpio + (0x1C/sizeof(unsigned int)), pin_num, S_HIGH, 0x01);
-		set_bits(gpio + (0x1C/sizeof(unsigned int)), pin_num, S_LOW, 0x01);
+	for (;;) {
+		spin_lock_irqsave(&m->lock, flags);
+		if (kfifo_avail(&c->fifo) >= n) {
+			break;
+		}
+		spin_unlock_irqrestore(&m->lock, flags);
+		if (nonblock) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(c->wait, kfifo_avail(&c->fifo) >= n)) {
+			return -ERESTARTSYS;
+		}
 	}
-	
+	kfifo_in(&c->fifo, el, n);
+	morse_kick(m, c);
+	spin_unlock_irqrestore(&m->lock, flags);
 	return 0;
 }
 
-/* return System Timer address */
-static volatile unsigned int *get_timer_addr(void)
+/* drive the channel pins and clear the channel state */
+static void morse_setup(struct morse *m, const unsigned int *chan_pins, unsigned int n)
 {
-	return (volatile unsigned int *)TIEMR_BASE;
+	struct morse_chan *c;
+	unsigned int i;
+
+	m->nch = n;
+	for (i = 0; i < n; i++) {
+		c = &m->ch[i];
+		c->pin = chan_pins[i];
+		c->bank = c->pin / 32;
+		c->bit = 1U << (c->pin % 32);
+		INIT_KFIFO(c->fifo);
+		init_waitqueue_head(&c->wait);
+		c->active = false;
+		c->mark = false;
+		set_pin(c->pin, S_OFF);
+		func_pin(c->pin, M_OUTPUT);
+	}
+	m->expiries = 0;
+	m->edges = 0;
+	m->stores = 0;
+	m->busy_ns = 0;
 }
 
-/* return time stamp */
-static unsigned long get_time_stamp(void)
+
+/* the inverse of morse_digits and morse_alpha */
+static void morse_rx_table_init(void)
 {
-	volatile unsigned long *timer = (volatile unsigned long *)get_timer_addr();
+	const char *code;
+	unsigned int i, n, bits;
 
-	/* There is a register that can store time stamp
-	   that is far as 0x04 from base */
-	/* Write 64bits constant using two 32bits from 0x04 to 0x08 */
-	return *(timer + 0x04/sizeof(unsigned int));
+	for (i = 0; i < 36; i++) {
+		code = i < 10 ? morse_digits[i] : morse_alpha[i - 10];
+		for (n = 0, bits = 0; code[n]; n++) {
+			if (code[n] == '-') {
+				bits |= 1U << n;
+			}
+		}
+		morse_rx_table[(1U << n) | bits] = i < 10 ? '0' + i : 'A' + i - 10;
+	}
 }
 
-/*  */
-static int timer_wait(const unsigned long delay)
+static void morse_decoder_init(struct morse_decoder *d, u32 dot_us)
 {
-	unsigned long start = get_time_stamp();
-	unsigned long elapsed = 0;
+	memset(d, 0, sizeof(*d));
+	d->dot_us = dot_us;
+}
 
-	while (elapsed < delay) {
-		elapsed = get_time_stamp() - start;
+/*
+ * a mark of mark_us ended: a dot or a dash.  Both move the dot estimate a
+ * quarter of the way to what they measured, and a dot shorter than the
+ * estimate half of the way: against a faster sender everything first
+ * looks like dots, whose mean alone would stay above half a dash.
+ */
+static void morse_rx_mark(struct morse_decoder *d, u32 mark_us)
+{
+	u32 dot = d->dot_us;
+
+	d->marks++;
+	if (mark_us < MORSE_RX_DASH * dot) {
+		dot = mark_us < dot ? (dot + mark_us) / 2 : (3 * dot + mark_us) / 4;
+	} else {
+		if (d->len < MORSE_MAX_ELEMS) {
+			d->code |= 1U << d->len;
+		}
+		dot = (3 * dot + mark_us / 3) / 4;
 	}
-	return 0;
+	d->len++;
+	d->dot_us = max(dot, 1U);
 }
 
+/*
+ * the line has been low for gap_us since the last mark: if that ends the
+ * character (and the word) put them in out, returns how many, at most 2
+ */
+static unsigned int morse_rx_gap(struct morse_decoder *d, u32 gap_us, char *out)
+{
+	unsigned int n = 0;
+	char ch = 0;
 
-static int ok05_open(struct inode *inode, struct file *filp)
+	if (gap_us < MORSE_RX_CHAR * d->dot_us) {
+		return 0;
+	}
+	if (d->len) {
+		if (d->len < MORSE_MAX_ELEMS) {
+			ch = morse_rx_table[(1U << d->len) | d->code];
+		}
+		if (ch) {
+			out[n++] = ch;
+			d->chars++;
+			d->word = true;
+		} else {
+			d->errors++;
+		}
+		d->code = 0;
+		d->len = 0;
+	}
+	if (gap_us >= MORSE_RX_WORD * d->dot_us && d->word) {
+		out[n++] = ' ';
+		d->word = false;
+	}
+	return n;
+}
+
+/* hand decoded characters to the readers; rx->lock held */
+static void morse_rx_put(struct morse_rx *rx, const char *out, unsigned int n)
+{
+	unsigned int copied;
+
+	if (!n) {
+		return;
+	}
+	copied = kfifo_in(&rx->text, out, n);
+	rx->dropped += n - copied;
+	wake_up_interruptible(&rx->wait);
+}
+
+static irqreturn_t morse_rx_irq(int irq, void *data)
 {
-	int i = 10;
+	struct morse_rx *rx = data;
+	unsigned long flags;
+	unsigned int n = 0;
+	char out[2];
+	u64 now;
+	u32 dur;
+	int level;
 
-	if (func_pin(CUR_GPIO, M_OUTPUT) != 0) {
-		PDEBUG("%s:%d: func_pin() Error\n", __FUNCTION__, __LINE__);
-		return -1;
+	spin_lock_irqsave(&rx->lock, flags);
+	now = get_time_stamp();
+	level = get_pin(rx->pin);
+	/* both edges of a pulse shorter than the IRQ latency are lost */
+	if (level != rx->level) {
+		dur = min_t(u64, now - rx->last_us, U32_MAX);
+		if (level) {
+			n = morse_rx_gap(&rx->dec, dur, out);
+		} else {
+			morse_rx_mark(&rx->dec, dur);
+			hrtimer_start(&rx->flush,
+				      ns_to_ktime((u64)MORSE_RX_FLUSH * rx->dec.dot_us * NSEC_PER_USEC),
+				      HRTIMER_MODE_REL);
+		}
+		rx->level = level;
+		rx->last_us = now;
+		morse_rx_put(rx, out, n);
 	}
-	
-	while (i--) {
-		if (set_pin(CUR_GPIO, S_OFF) != 0) {
-			PDEBUG("%s:%d: set_pin() Error\n", __FUNCTION__, __LINE__);
-			return -1;
+	spin_unlock_irqrestore(&rx->lock, flags);
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * no mark followed the last one: the character is complete.  While the
+ * line stays low the timer comes back at MORSE_RX_WORD dots for the space
+ * after the word, which no rising edge may ever deliver.
+ */
+static enum hrtimer_restart morse_rx_flush(struct hrtimer *t)
+{
+	struct morse_rx *rx = container_of(t, struct morse_rx, flush);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	unsigned int n;
+	char out[2];
+	u64 gap, word;
+
+	spin_lock_irqsave(&rx->lock, flags);
+	if (!rx->level) {
+		gap = get_time_stamp() - rx->last_us;
+		n = morse_rx_gap(&rx->dec, min_t(u64, gap, U32_MAX), out);
+		morse_rx_put(rx, out, n);
+		word = (u64)MORSE_RX_WORD * rx->dec.dot_us;
+		if (rx->dec.word && gap < word) {
+			hrtimer_forward_now(t, ns_to_ktime((word - gap) * NSEC_PER_USEC));
+			ret = HRTIMER_RESTART;
 		}
+	}
+	spin_unlock_irqrestore(&rx->lock, flags);
+	return ret;
+}
 
-		timer_wait(TIMER_DELAY);
+/* stop the IRQs and timers of the first n receivers */
+static void morse_rx_teardown(struct morse *m, unsigned int n)
+{
+	struct morse_rx *rx;
+	unsigned int i;
 
-		if (set_pin(CUR_GPIO, S_ON) != 0) {
-			PDEBUG("%s:%d: set_pin() Error\n", __FUNCTION__, __LINE__);
-			return -1;
+	for (i = 0; i < n; i++) {
+		rx = &m->rx[i];
+		if (rx->irq >= 0) {
+			free_irq(rx->irq, rx);
+			gpio_free(gpio_base + rx->pin);
 		}
-		timer_wait(TIMER_DELAY);		
+		hrtimer_cancel(&rx->flush);
 	}
+}
 
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);	
+static int morse_rx_setup(struct morse_rx *rx, unsigned int pin)
+{
+	int ret;
+
+	rx->pin = pin;
+	rx->irq = -1;
+	spin_lock_init(&rx->lock);
+	mutex_init(&rx->read_lock);
+	init_waitqueue_head(&rx->wait);
+	INIT_KFIFO(rx->text);
+	hrtimer_setup(&rx->flush, morse_rx_flush, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	morse_decoder_init(&rx->dec, unit_us);
+
+	func_pin(pin, M_INPUT);
+	rx->level = get_pin(pin);
+	rx->last_us = get_time_stamp();
+
+#ifndef GPIO_BCM_SIMULATE
+	ret = gpio_request(gpio_base + pin, DEV_OK05_NAME);
+	if (ret) {
+		return ret;
+	}
+	ret = gpio_to_irq(gpio_base + pin);
+	if (ret < 0) {
+		gpio_free(gpio_base + pin);
+		return ret;
+	}
+	rx->irq = ret;
+	ret = request_irq(rx->irq, morse_rx_irq,
+			  IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+			  DEV_OK05_NAME, rx);
+	if (ret) {
+		rx->irq = -1;
+		gpio_free(gpio_base + pin);
+		return ret;
+	}
+#else
+	ret = 0;
+#endif
+	return ret;
+}
+
+
+static int ok05_open(struct inode *inode, struct file *filp)
+{
+	struct morse_chan *c;
+	struct ok05_file *f;
+
+	/* no greeting blink: the channel may be sending for another opener */
+	if (iminor(inode) >= morse_dev.nch) {
+		return -ENODEV;
+	}
+	c = &morse_dev.ch[iminor(inode)];
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f) {
+		return -ENOMEM;
+	}
+	f->c = c;
+	f->rx = iminor(inode) < morse_dev.nrx ? &morse_dev.rx[iminor(inode)] : NULL;
+	f->format = GPIO_OK05_FORMAT_TEXT;
+	filp->private_data = f;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
 	return 0;
 }
 
+static int ok05_flush_held(struct ok05_file *f, bool nonblock);
+
+/* queued characters keep playing after close() */
 static int ok05_release(struct inode *inode, struct file *filp)
 {
-	set_pin(CUR_GPIO, S_OFF);
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);	
+	struct ok05_file *f = filp->private_data;
+
+	ok05_flush_held(f, false);
+	kfree(f);
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
 	return 0;
 }
 
@@ -228,151 +730,536 @@ static int is_digit_or_alpha(const char character)
 	if (character < '0' || character > 'z') return -1;
 	if (character > '9' && character < 'A') return -1;
 	if (character > 'Z' && character < 'a') return -1;
-	return 0;	
+	return 0;
 }
 
 static char to_upper(char character)
 {
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);	
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
 	if (character >= 'a' && character <= 'z') {
 		character -= 32;
 	}
 	return character;
 }
 
-/* dot action */
-static int dot(void)
+/* queue one character on channel c using morse code */
+static int print_morse(struct morse_chan *c, char status, bool nonblock)
 {
-	printk(".");
-	set_pin(CUR_GPIO, S_ON);
-	timer_wait(MORSE_DELAY);
-	set_pin(CUR_GPIO, S_OFF);
-	timer_wait(MORSE_DELAY);
-	return 0;
+	u8 el[MORSE_MAX_ELEMS];
+	const char *code;
+	unsigned int n;
+
+	if (is_digit_or_alpha(status) != 0) {
+		PDEBUG("%s:%d : is_digit_or_alpha() error\n", __FUNCTION__, __LINE__);
+		return -EINVAL;
+	}
+
+	PDEBUG("%s:%d : status = %c\n", __FUNCTION__, __LINE__, status);
+	status = to_upper(status);
+
+	if (status == ' ') {
+		el[0] = MORSE_WORD;
+		return morse_queue(&morse_dev, c, el, 1, nonblock);
+	}
+
+	code = status <= '9' ? morse_digits[status - '0'] : morse_alpha[status - 'A'];
+	for (n = 0; code[n]; n++) {
+		el[n] = code[n] == '.' ? MORSE_DOT : MORSE_DASH;
+	}
+	el[n - 1] = MORSE_ELEM(MORSE_ON(el[n - 1]), MORSE_CHAR_GAP);
+	return morse_queue(&morse_dev, c, el, n, nonblock);
 }
 
-/* dash action */
-static int dash(void)
+/*
+ * queue n bytes of packed symbols in one go.  Each symbol gives at most
+ * one element; the held dot or dash only moves on once they are queued,
+ * so a failed call can be repeated.
+ */
+static int ok05_queue_packed(struct ok05_file *f, const u8 *sym, unsigned int n, bool nonblock)
 {
-	printk("-");
-	set_pin(CUR_GPIO, S_ON);
-	timer_wait(MORSE_DELAY);
-	set_pin(CUR_GPIO, S_OFF);
-	timer_wait(MORSE_DELAY);
+	u8 el[4 * MORSE_PACKED_CHUNK];
+	unsigned int i, shift, ne = 0;
+	u8 held = f->held;
+	int ret;
+
+	for (i = 0; i < n; i++) {
+		for (shift = 0; shift < 8; shift += 2) {
+			switch ((sym[i] >> shift) & 3) {
+			case GPIO_OK05_SYM_DOT:
+				if (held) {
+					el[ne++] = held;
+				}
+				held = MORSE_DOT;
+				break;
+			case GPIO_OK05_SYM_DASH:
+				if (held) {
+					el[ne++] = held;
+				}
+				held = MORSE_DASH;
+				break;
+			case GPIO_OK05_SYM_GAP:
+				if (held) {
+					el[ne++] = MORSE_ELEM(MORSE_ON(held), MORSE_CHAR_GAP);
+					held = 0;
+				} else {
+					el[ne++] = MORSE_WORD;
+				}
+				break;
+			}
+		}
+	}
+
+	if (ne) {
+		ret = morse_queue(&morse_dev, f->c, el, ne, nonblock);
+		if (ret) {
+			return ret;
+		}
+	}
+	f->held = held;
 	return 0;
 }
 
-/* output character to LED using morse code */
-static int print_morse(char status)
+/* end the character a packed write left open */
+static int ok05_flush_held(struct ok05_file *f, bool nonblock)
 {
-	static char pre_status = 0;
+	u8 el;
+	int ret;
 
-	if (is_digit_or_alpha(status) != 0) {
-		PDEBUG("%s:%s : is_digit_or_alpha() error\n", __FUNCTION__, __LINE__);
-		return -1;
+	if (!f->held) {
+		return 0;
 	}
-
-	PDEBUG("%s:%d : status = %c\n", __FUNCTION__, __LINE__, status);
-	status = to_upper(status);
-
-	switch (status) {
-    /* numbers */
-    case '0' : dash(); dash(); dash(); dash(); dash(); break;
-    case '1' : dot(); dash(); dash(); dash(); dash(); break;
-    case '2' : dot(); dot(); dash(); dash(); dash(); break;
-    case '3' : dot(); dot(); dot(); dash(); dash(); break;
-    case '4' : dot(); dot(); dot(); dot(); dash(); break;
-    case '5' : dot(); dot(); dot(); dot(); dot(); break;
-    case '6' : dash(); dot(); dot(); dot(); dot(); break;
-    case '7' : dash(); dash(); dot(); dot(); dot(); break;
-    case '8' : dash(); dash(); dash(); dot(); dot(); break;
-    case '9' : dash(); dash(); dash(); dash(); dot(); break;
-    /* alphabets */
-    case 'A' : dot(); dash(); break;
-    case 'B' : dash(); dot(); dot(); dot(); break;
-    case 'C' : dash(); dot(); dash(); dot(); break;
-    case 'D' : dash(); dot(); dot(); break;
-    case 'E' : dot(); break;
-    case 'F' : dot(); dot(); dash(); dot(); break;
-    case 'G' : dash(); dash(); dot(); break;
-    case 'H' : dot(); dot(); dot(); dot(); break;
-    case 'I' : dot(); dot(); break;
-    case 'J' : dot(); dash(); dash(); dash(); break;
-    case 'K' : dash(); dot(); dash(); break;
-    case 'L' : dot(); dash(); dot(); dot(); break;
-    case 'M' : dash(); dash(); break;
-    case 'N' : dash(); dot(); break;
-    case 'O' : dash(); dash(); dash(); break;
-    case 'P' : dot(); dash(); dash(); dot(); break;
-    case 'Q' : dash(); dash(); dot(); dash(); break;
-    case 'R' : dot(); dash(); dot(); break;
-    case 'S' : dot(); dot(); dot(); break;
-    case 'T' : dash(); break;
-    case 'U' : dot(); dot(); dash(); break;
-    case 'V' : dot(); dot(); dot(); dash(); break;
-    case 'W' : dot(); dash(); dash(); break;
-    case 'X' : dash(); dot(); dot(); dash(); break;
-    case 'Y' : dash(); dot(); dash(); dash(); break;
-    case 'Z' : dash(); dash(); dot(); dot(); break;
-	/* space */
-	case ' ' : timer_wait(MORSE_DELAY * 6); break;
-	}
-
-	if (pre_status != status) {
-		timer_wait(MORSE_DELAY * 2);
-	}
-	pre_status = status;
-	printk("\n");
-	return 0;
+	el = MORSE_ELEM(MORSE_ON(f->held), MORSE_CHAR_GAP);
+	ret = morse_queue(&morse_dev, f->c, &el, 1, nonblock);
+	if (!ret) {
+		f->held = 0;
+	}
+	return ret;
 }
 
 
-static ssize_t ok05_read(struct file *filp, const char *buf, size_t count, loff_t *f_pos)
+/*
+ * the text received so far, or without an input one snapshot of all pin
+ * levels, see gpio-ioctl.h
+ */
+static ssize_t ok05_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
 {
-	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);	
-	return 0;
+	struct ok05_file *f = filp->private_data;
+	struct morse_rx *rx = f->rx;
+	unsigned int copied;
+	int ret;
+
+	if (!rx) {
+		return gpio_ioc_read(NULL, buf, count);
+	}
+
+	if (mutex_lock_interruptible(&rx->read_lock)) {
+		return -ERESTARTSYS;
+	}
+
+	while (kfifo_is_empty(&rx->text)) {
+		mutex_unlock(&rx->read_lock);
+		if (filp->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(rx->wait, !kfifo_is_empty(&rx->text))) {
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&rx->read_lock)) {
+			return -ERESTARTSYS;
+		}
+	}
+
+	ret = kfifo_to_user(&rx->text, buf, count, &copied);
+	mutex_unlock(&rx->read_lock);
+
+	return ret ? ret : copied;
 }
 
 static ssize_t ok05_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
 {
-	int i;
+	struct ok05_file *f = filp->private_data;
+	bool nonblock = filp->f_flags & O_NONBLOCK;
+	u8 sym[MORSE_PACKED_CHUNK];
+	size_t i, n;
 	char status;
+	int ret;
 	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
 
+	if (f->format == GPIO_OK05_FORMAT_PACKED) {
+		for (i = 0; i < count; i += n) {
+			n = min_t(size_t, count - i, MORSE_PACKED_CHUNK);
+			if (copy_from_user(sym, buf + i, n)) {
+				return i ? i : -EFAULT;
+			}
+			ret = ok05_queue_packed(f, sym, n, nonblock);
+			if (ret) {
+				return i ? i : ret;
+			}
+		}
+		return count;
+	}
+
 	for (i = 0; i < count; i++) {
-		get_user(status, (char *)buf + i);
-		if (print_morse(status) != 0) {
-			continue;
+		if (get_user(status, buf + i)) {
+			return i ? i : -EFAULT;
+		}
+		ret = print_morse(f->c, status, nonblock);
+		if (ret == -EAGAIN || ret == -ERESTARTSYS) {
+			return i ? i : ret;
 		}
 	}
 	return count;
 }
 
+/* wait until everything written to the channel has been sent */
+static int ok05_fsync(struct file *filp, loff_t start, loff_t end, int datasync)
+{
+	struct ok05_file *f = filp->private_data;
+	int ret;
+
+	ret = ok05_flush_held(f, false);
+	if (ret) {
+		return ret;
+	}
+	return wait_event_interruptible(f->c->wait, !READ_ONCE(f->c->active));
+}
+
+static long ok05_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct ok05_file *f = filp->private_data;
+	__u32 format;
+	int ret;
+
+	switch (cmd) {
+	case GPIO_OK05_IOC_FORMAT:
+		if (get_user(format, (__u32 __user *)arg)) {
+			return -EFAULT;
+		}
+		if (format != GPIO_OK05_FORMAT_TEXT && format != GPIO_OK05_FORMAT_PACKED) {
+			return -EINVAL;
+		}
+		/* text starts a new character */
+		ret = ok05_flush_held(f, filp->f_flags & O_NONBLOCK);
+		if (ret) {
+			return ret;
+		}
+		f->format = format;
+		return 0;
+	default:
+		return gpio_ioc_ioctl(NULL, cmd, arg);
+	}
+}
+
 static struct file_operations ok05_fops = {
 	.owner = THIS_MODULE,
 	.open = ok05_open,
 	.release = ok05_release,
 	.read = ok05_read,
-	.write = ok05_write
+	.write = ok05_write,
+	.fsync = ok05_fsync,
+	.unlocked_ioctl = ok05_ioctl
 };
 
 
+#ifdef GPIO_BCM_SIMULATE
+static const char bench_text[] = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 0123456789 ";
+
+static void ok05_benchmark_channels(struct morse *m, unsigned int n)
+{
+	unsigned int bench_pins[MORSE_MAX_CHANNELS], i, k;
+	u64 start, elapsed;
+
+	for (i = 0; i < n; i++) {
+		bench_pins[i] = i;
+	}
+	morse_setup(m, bench_pins, n);
+
+	start = ktime_get_ns();
+	for (k = 0; k < bench_chars; k++) {
+		for (i = 0; i < n; i++) {
+			if (print_morse(&m->ch[i], bench_text[(k + i * 7) % (sizeof(bench_text) - 1)], false) == -ERESTARTSYS) {
+				return;
+			}
+		}
+	}
+	if (wait_event_interruptible(m->idle, !READ_ONCE(m->nheap))) {
+		return;
+	}
+	elapsed = ktime_get_ns() - start;
+
+	printk(KERN_INFO "[GPIO-OK05] %2u channels: %llu edges, %llu expiries, %llu stores, %llu ns per expiry, CPU %llu ppm\n",
+	       n, m->edges, m->expiries, m->stores,
+	       m->expiries ? div64_u64(m->busy_ns, m->expiries) : 0,
+	       elapsed ? div64_u64(m->busy_ns * 1000000, elapsed) : 0);
+}
+
+/* text as packed symbols, returns the number of bytes */
+static unsigned int ok05_pack(const char *s, u8 *out)
+{
+	unsigned int nsym = 0, i;
+	const char *code;
+
+	for (; *s; s++) {
+		if (*s != ' ') {
+			code = *s <= '9' ? morse_digits[*s - '0'] : morse_alpha[*s - 'A'];
+			for (i = 0; code[i]; i++, nsym++) {
+				if (nsym % 4 == 0) {
+					out[nsym / 4] = GPIO_OK05_SYM_NONE;
+				}
+				out[nsym / 4] |= (code[i] == '.' ? GPIO_OK05_SYM_DOT : GPIO_OK05_SYM_DASH) << (nsym % 4 * 2);
+			}
+		}
+		if (nsym % 4 == 0) {
+			out[nsym / 4] = GPIO_OK05_SYM_NONE;
+		}
+		out[nsym / 4] |= GPIO_OK05_SYM_GAP << (nsym % 4 * 2);
+		nsym++;
+	}
+	return (nsym + 3) / 4;
+}
+
+/* take the queue of channel c and empty it, returns its length */
+static unsigned int ok05_drain(struct morse *m, struct morse_chan *c, u8 *el)
+{
+	unsigned long flags;
+	unsigned int n;
+
+	spin_lock_irqsave(&m->lock, flags);
+	n = kfifo_out(&c->fifo, el, MORSE_FIFO);
+	spin_unlock_irqrestore(&m->lock, flags);
+	return n;
+}
+
+/*
+ * Ingest cost of the two write formats: the text goes through
+ * print_morse() character by character, the same text packed through
+ * ok05_queue_packed(), both into one channel that is marked active but
+ * kept off the heap, so nothing plays and the queue is emptied after
+ * every sentence.  The elements queued by both must be the same.
+ */
+static void ok05_benchmark_ingest(struct morse *m)
+{
+	static u8 text_el[MORSE_FIFO], packed_el[MORSE_FIFO];
+	struct ok05_file f = { .format = GPIO_OK05_FORMAT_PACKED };
+	unsigned int chan_pin = 0, rounds, r, i, nbytes, ntext = 0, npacked = 0;
+	u8 packed[sizeof(bench_text) * 2];
+	u64 start, text_ns = 0, packed_ns = 0, chars;
+
+	morse_setup(m, &chan_pin, 1);
+	f.c = &m->ch[0];
+	f.c->active = true;
+	nbytes = ok05_pack(bench_text, packed);
+	rounds = DIV_ROUND_UP(bench_ingest, sizeof(bench_text) - 1);
+
+	for (r = 0; r < rounds; r++) {
+		start = ktime_get_ns();
+		for (i = 0; i < sizeof(bench_text) - 1; i++) {
+			print_morse(f.c, bench_text[i], true);
+		}
+		text_ns += ktime_get_ns() - start;
+		ntext = ok05_drain(m, f.c, text_el);
+
+		start = ktime_get_ns();
+		for (i = 0; i < nbytes; i += MORSE_PACKED_CHUNK) {
+			ok05_queue_packed(&f, packed + i, min_t(unsigned int, nbytes - i, MORSE_PACKED_CHUNK), true);
+		}
+		packed_ns += ktime_get_ns() - start;
+		npacked = ok05_drain(m, f.c, packed_el);
+	}
+	f.c->active = false;
+
+	chars = (u64)rounds * (sizeof(bench_text) - 1);
+	printk(KERN_INFO "[GPIO-OK05] ingest of %llu characters: text %llu ns (%llu chars/s), packed %llu ns in %u bytes per %zu characters (%llu chars/s), %s\n",
+	       chars, text_ns, text_ns ? div64_u64(chars * NSEC_PER_SEC, text_ns) : 0,
+	       packed_ns, nbytes, sizeof(bench_text) - 1,
+	       packed_ns ? div64_u64(chars * NSEC_PER_SEC, packed_ns) : 0,
+	       ntext == npacked && !memcmp(text_el, packed_el, ntext) ? "same elements" : "ELEMENTS DIFFER");
+}
+
+/* duration of units at unit_us, off by up to jitter percent */
+static u32 ok05_jitter(u32 unit_us, unsigned int units, unsigned int jitter, u64 *seed)
+{
+	u32 d = unit_us * units;
+
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return d + (s64)d * ((s64)(*seed % (2 * jitter + 1)) - jitter) / 100;
+}
+
+/*
+ * bench_text as the marks and spaces a receiver would time, alternately
+ * starting with a mark; returns how many
+ */
+static unsigned int ok05_synth(u32 unit_us, unsigned int jitter, u64 *seed, u32 *dur)
+{
+	const char *s, *code;
+	unsigned int n = 0, i;
+
+	for (s = bench_text; *s; s++) {
+		if (*s == ' ') {
+			dur[n - 1] += ok05_jitter(unit_us, 4, jitter, seed);
+			continue;
+		}
+		code = *s <= '9' ? morse_digits[*s - '0'] : morse_alpha[*s - 'A'];
+		for (i = 0; code[i]; i++) {
+			dur[n++] = ok05_jitter(unit_us, code[i] == '.' ? 1 : 3, jitter, seed);
+			dur[n++] = ok05_jitter(unit_us, code[i + 1] ? 1 : MORSE_CHAR_GAP, jitter, seed);
+		}
+	}
+	return n;
+}
+
+/*
+ * The receive decoder against synthetic edges: the sender at the
+ * expected unit, twice as fast and half as fast, and with more jitter.
+ * The estimate starts at unit_us each time and must catch up; every
+ * sentence is compared with bench_text, character by character.
+ */
+static void ok05_benchmark_decode(void)
+{
+	static const struct {
+		unsigned int num, den, jitter;
+	} runs[] = {
+		{ 1, 1, 10 }, { 1, 2, 10 }, { 2, 1, 10 }, { 1, 1, 25 },
+	};
+	static u32 dur[2 * MORSE_MAX_ELEMS * sizeof(bench_text)];
+	static char text[2 * MORSE_MAX_ELEMS * sizeof(bench_text)];
+	struct morse_decoder d;
+	unsigned int run, rounds, r, i, n, len, wrong;
+	u64 seed = 0x9E3779B97F4A7C15ULL, start, ns, edges;
+
+	rounds = DIV_ROUND_UP(bench_decode, sizeof(bench_text) - 1);
+	for (run = 0; run < ARRAY_SIZE(runs); run++) {
+		morse_decoder_init(&d, unit_us);
+		wrong = 0;
+		ns = 0;
+		edges = 0;
+		for (r = 0; r < rounds; r++) {
+			n = ok05_synth(unit_us * runs[run].num / runs[run].den, runs[run].jitter, &seed, dur);
+			len = 0;
+			start = ktime_get_ns();
+			for (i = 0; i < n; i += 2) {
+				morse_rx_mark(&d, dur[i]);
+				len += morse_rx_gap(&d, dur[i + 1], text + len);
+			}
+			ns += ktime_get_ns() - start;
+			edges += n;
+
+			for (i = 0; i < sizeof(bench_text) - 1; i++) {
+				wrong += i >= len || text[i] != bench_text[i];
+			}
+		}
+		printk(KERN_INFO "[GPIO-OK05] decode at %u/%u unit, jitter %u%%: %u of %u characters wrong, %llu decode errors, dot %u us, %llu ns per edge\n",
+		       runs[run].num, runs[run].den, runs[run].jitter,
+		       wrong, rounds * (unsigned int)(sizeof(bench_text) - 1), d.errors, d.dot_us,
+		       edges ? div64_u64(ns, edges) : 0);
+	}
+}
+
+static void ok05_benchmark(struct morse *m)
+{
+	if (bench_chars) {
+		ok05_benchmark_channels(m, 1);
+		ok05_benchmark_channels(m, 8);
+		ok05_benchmark_channels(m, 32);
+	}
+	if (bench_ingest) {
+		ok05_benchmark_ingest(m);
+	}
+	if (bench_decode) {
+		ok05_benchmark_decode();
+	}
+}
+#endif
+
+
 static int ok05_init(void)
 {
+	struct morse *m = &morse_dev;
+	unsigned int i;
+	int ret;
+
 	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
-	register_chrdev(DEV_OK05_MAJOR_NUMBER, DEV_OK05_NAME, &ok05_fops);
+
+	/* registers are mapped by gpio-bcm */
+	if (gpio_bcm_ready()) {
+		return -ENODEV;
+	}
+
+	if (unit_us == 0) {
+		return -EINVAL;
+	}
+	for (i = 0; i < npins; i++) {
+		if (pins[i] > GPIO_MAX_PIN) {
+			return -EINVAL;
+		}
+	}
+	if (nrx > npins) {
+		return -EINVAL;
+	}
+	for (i = 0; i < nrx; i++) {
+		if (rx_pins[i] > GPIO_MAX_PIN) {
+			return -EINVAL;
+		}
+	}
+	morse_rx_table_init();
+
+	spin_lock_init(&m->lock);
+	init_waitqueue_head(&m->idle);
+	hrtimer_setup(&m->timer, morse_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	m->unit_ns = (u64)unit_us * NSEC_PER_USEC;
+	m->epoch_ns = ktime_get_ns();
+
+#ifdef GPIO_BCM_SIMULATE
+	if (bench_chars || bench_ingest || bench_decode) {
+		ok05_benchmark(m);
+		hrtimer_cancel(&m->timer);
+		m->nheap = 0;
+	}
+#endif
+	morse_setup(m, pins, npins);
+
+	for (i = 0; i < nrx; i++) {
+		ret = morse_rx_setup(&m->rx[i], rx_pins[i]);
+		if (ret) {
+			hrtimer_cancel(&m->rx[i].flush);
+			morse_rx_teardown(m, i);
+			return ret;
+		}
+		m->nrx = i + 1;
+	}
+
+	ret = register_chrdev(DEV_OK05_MAJOR_NUMBER, DEV_OK05_NAME, &ok05_fops);
+	if (ret < 0) {
+		morse_rx_teardown(m, m->nrx);
+		return ret;
+	}
 	return 0;
 }
 
 
 static void ok05_exit(void)
 {
+	struct morse *m = &morse_dev;
+	unsigned int i;
+
 	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
 	unregister_chrdev(DEV_OK05_MAJOR_NUMBER, DEV_OK05_NAME);
+	hrtimer_cancel(&m->timer);
+	for (i = 0; i < m->nch; i++) {
+		set_pin(m->ch[i].pin, S_OFF);
+	}
+	morse_rx_teardown(m, m->nrx);
+	PDEBUG("edges %llu, expiries %llu, stores %llu\n", m->edges, m->expiries, m->stores);
+	for (i = 0; i < m->nrx; i++) {
+		PDEBUG("rx pin %u: marks %llu, chars %llu, errors %llu, dropped %llu, dot %u us\n",
+		       m->rx[i].pin, m->rx[i].dec.marks, m->rx[i].dec.chars,
+		       m->rx[i].dec.errors, m->rx[i].dropped, m->rx[i].dec.dot_us);
+	}
 }
 
 
 module_init(ok05_init);
 module_exit(ok05_exit);
 MODULE_LICENSE("Dual BSD/GPL");
-
@@ -0,0 +1,50 @@
+/*
+ * GPIO-OK05 write formats and ioctl interface
+ *
+ * By default write() takes text: digits, letters and spaces, each letter
+ * looked up in the Morse tables.  GPIO_OK05_IOC_FORMAT switches the open
+ * file to packed symbols instead, four per byte, least significant bits
+ * first:
+ *
+ *   GPIO_OK05_SYM_NONE  skipped, pads the last byte
+ *   GPIO_OK05_SYM_DOT   one unit on
+ *   GPIO_OK05_SYM_DASH  three units on
+ *   GPIO_OK05_SYM_GAP   ends the character; a second one in a row ends
+ *                       the word, like a space in text
+ *
+ * Dots and dashes are followed by one unit off, a character by three and
+ * a word by seven, so "E T" is DOT GAP GAP DASH GAP in either format.
+ * A character not ended by a gap is held back until the next symbol, the
+ * switch back to text, fsync() or close().
+ *
+ * On a channel with a receive pin (rx_pins=) read() returns the text
+ * decoded from it: upper case letters, digits, and a space after each
+ * word.  Codes that are no letter or digit are dropped.  Without a
+ * receive pin read() returns the level snapshot of gpio-ioctl.h.
+ */
+#ifndef GPIO_OK05_H
+#define GPIO_OK05_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+#endif
+
+/* write() formats */
+#define GPIO_OK05_FORMAT_TEXT 0
+#define GPIO_OK05_FORMAT_PACKED 1
+
+/* 2-bit symbols of GPIO_OK05_FORMAT_PACKED */
+#define GPIO_OK05_SYM_NONE 0
+#define GPIO_OK05_SYM_DOT 1
+#define GPIO_OK05_SYM_DASH 2
+#define GPIO_OK05_SYM_GAP 3
+
+#define GPIO_OK05_IOC_MAGIC 'm'
+#define GPIO_OK05_IOC_FORMAT _IOW(GPIO_OK05_IOC_MAGIC, 1, __u32)
+
+#endif /* GPIO_OK05_H */
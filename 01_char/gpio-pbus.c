@@ -0,0 +1,261 @@
+/*
+ * GPIO-PBUS - parallel output bus on a group of GPIO pins
+ *
+ * The pins given in pins= form one bus word, pins[0] being bit 0.  Each
+ * word written to the device is scattered onto the banks through the
+ * pin group table of gpio-bcm.h and costs one GPSET plus one GPCLR store
+ * per bank, instead of a set_pin() per bit.
+ *
+ * Words are 1, 2 or 4 bytes in host order, depending on the bus width.
+ * With strobe= set, the strobe pin is pulled low in the same GPCLR store
+ * that lays out the data and raised afterwards, so a display or latch
+ * takes the word on the rising edge.
+ *
+ *   insmod gpio-pbus.ko pins=4,5,6,7,8,9,10,11 strobe=12 bench_words=100000
+ *   mknod /dev/gpio-pbus c 232 0
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
+
+#include "gpio-bcm.h"
+
+/*
+ * Debug option
+ */
+#define GPIO_PBUS_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef GPIO_PBUS_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[GPIO-PBUS] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module major number */
+static int DEV_PBUS_MAJOR_NUMBER = 232;
+/* Module name */
+#define DEV_PBUS_NAME "gpio-pbus"
+
+/* bytes copied from userspace per round */
+#define PBUS_CHUNK 4096
+
+static unsigned int pins[GPIO_GROUP_MAX] = { 4, 5, 6, 7, 8, 9, 10, 11 };
+static unsigned int npins = 8;
+module_param_array(pins, uint, &npins, 0444);
+MODULE_PARM_DESC(pins, "Bus pins, least significant bit first");
+
+static int strobe = -1;
+module_param(strobe, int, 0444);
+MODULE_PARM_DESC(strobe, "Strobe pin pulsed after every word, -1 for none");
+
+static unsigned int bench_words;
+module_param(bench_words, uint, 0444);
+MODULE_PARM_DESC(bench_words, "Write this many words at load and report the rate");
+
+struct pbus {
+	/* serializes writers */
+	struct mutex lock;
+	struct gpio_group group;
+	/* bytes per word */
+	unsigned int word_size;
+	unsigned int strobe_bank;
+	unsigned int strobe_bit;
+	u8 buf[PBUS_CHUNK];
+	/* statistics, printed on unload */
+	u64 words;
+	u64 busy_ns;
+};
+
+static struct pbus pbus_dev;
+
+
+/* put one word on the bus and strobe it */
+static inline void pbus_put(struct pbus *pb, unsigned int word)
+{
+	unsigned int set[GPIO_BANKS], clr, bank;
+
+	gpio_group_scatter(&pb->group, word, set);
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		clr = pb->group.mask[bank] & ~set[bank];
+		if (bank == pb->strobe_bank) {
+			clr |= pb->strobe_bit;
+		}
+		gpio_set_mask(bank, set[bank]);
+		gpio_clr_mask(bank, clr);
+	}
+	gpio_set_mask(pb->strobe_bank, pb->strobe_bit);
+}
+
+/* push n words of pb->word_size bytes from buf */
+static void pbus_put_words(struct pbus *pb, const u8 *buf, unsigned int n)
+{
+	unsigned int i;
+
+	switch (pb->word_size) {
+	case 1:
+		for (i = 0; i < n; i++) {
+			pbus_put(pb, buf[i]);
+		}
+		break;
+	case 2:
+		for (i = 0; i < n; i++) {
+			pbus_put(pb, ((const u16 *)buf)[i]);
+		}
+		break;
+	default:
+		for (i = 0; i < n; i++) {
+			pbus_put(pb, ((const u32 *)buf)[i]);
+		}
+		break;
+	}
+}
+
+static void pbus_benchmark(struct pbus *pb)
+{
+	unsigned int left = bench_words, n;
+	u64 start, elapsed;
+
+	memset(pb->buf, 0xA5, sizeof(pb->buf));
+	start = ktime_get_ns();
+	while (left) {
+		n = min_t(unsigned int, left, PBUS_CHUNK / pb->word_size);
+		pbus_put_words(pb, pb->buf, n);
+		left -= n;
+	}
+	elapsed = ktime_get_ns() - start;
+
+	printk(KERN_INFO "[GPIO-PBUS] %u words of %u bits in %llu ns: %llu words/s\n",
+	       bench_words, pb->group.npins, elapsed,
+	       elapsed ? div64_u64((u64)bench_words * NSEC_PER_SEC, elapsed) : 0);
+}
+
+
+static int pbus_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = &pbus_dev;
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static int pbus_release(struct inode *inode, struct file *filp)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+/* stream whole words to the bus; a trailing partial word is not consumed */
+static ssize_t pbus_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct pbus *pb = filp->private_data;
+	size_t done = 0, chunk;
+	u64 start;
+
+	count -= count % pb->word_size;
+	if (count == 0) {
+		return -EINVAL;
+	}
+
+	if (mutex_lock_interruptible(&pb->lock)) {
+		return -ERESTARTSYS;
+	}
+
+	start = ktime_get_ns();
+	while (done < count) {
+		chunk = min_t(size_t, count - done, PBUS_CHUNK);
+		if (copy_from_user(pb->buf, buf + done, chunk)) {
+			break;
+		}
+		pbus_put_words(pb, pb->buf, chunk / pb->word_size);
+		done += chunk;
+	}
+	pb->busy_ns += ktime_get_ns() - start;
+	pb->words += done / pb->word_size;
+
+	mutex_unlock(&pb->lock);
+	return done ? done : -EFAULT;
+}
+
+static struct file_operations pbus_fops = {
+	.owner = THIS_MODULE,
+	.open = pbus_open,
+	.release = pbus_release,
+	.write = pbus_write
+};
+
+
+static int gpio_pbus_init(void)
+{
+	struct pbus *pb = &pbus_dev;
+	unsigned int i;
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	/* registers are mapped by gpio-bcm */
+	if (gpio_bcm_ready()) {
+		return -ENODEV;
+	}
+
+	if (strobe > GPIO_MAX_PIN) {
+		return -EINVAL;
+	}
+	for (i = 0; i < npins; i++) {
+		if (strobe >= 0 && pins[i] == strobe) {
+			return -EINVAL;
+		}
+	}
+	if (gpio_group_init(&pb->group, pins, npins) != 0) {
+		return -EINVAL;
+	}
+
+	mutex_init(&pb->lock);
+	pb->word_size = npins <= 8 ? 1 : (npins <= 16 ? 2 : 4);
+	if (strobe >= 0) {
+		pb->strobe_bank = strobe / 32;
+		pb->strobe_bit = 1U << (strobe % 32);
+		set_pin(strobe, S_ON);
+		func_pin(strobe, M_OUTPUT);
+	}
+
+	gpio_group_write(&pb->group, 0);
+	gpio_group_func(&pb->group, M_OUTPUT);
+
+	if (bench_words) {
+		pbus_benchmark(pb);
+	}
+
+	ret = register_chrdev(DEV_PBUS_MAJOR_NUMBER, DEV_PBUS_NAME, &pbus_fops);
+	if (ret < 0) {
+		return ret;
+	}
+	return 0;
+}
+
+static void gpio_pbus_exit(void)
+{
+	struct pbus *pb = &pbus_dev;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	unregister_chrdev(DEV_PBUS_MAJOR_NUMBER, DEV_PBUS_NAME);
+	gpio_group_func(&pb->group, M_INPUT);
+	if (strobe >= 0) {
+		func_pin(strobe, M_INPUT);
+	}
+	PDEBUG("words %llu, %llu words/s while busy\n", pb->words,
+	       pb->busy_ns ? div64_u64(pb->words * NSEC_PER_SEC, pb->busy_ns) : 0);
+}
+
+
+module_init(gpio_pbus_init);
+module_exit(gpio_pbus_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Parallel output bus on BCM2837 GPIO");
@@ -0,0 +1,460 @@
+/*
+ * GPIO-SPI - bit-banged SPI master on arbitrary GPIO pins
+ *
+ * SCLK and MOSI are usually in the same bank, so every clock half-cycle
+ * is precomputed as a pair of bank masks and emitted with one GPSET and/or
+ * one GPCLR store instead of a func_pin()/set_pin() call per pin.  MOSI is
+ * only included when it actually changes, so most half-cycles are a
+ * single store.  MISO is sampled with one GPLEV read just before the
+ * sampling edge.
+ *
+ * Transfers, mode (0-3) and clock are set through the ioctls in
+ * gpio-spi.h.  SCLK edges are placed on absolute deadlines like in
+ * gpio-i2c, at GPIO_SPI_MIN_HZ to GPIO_SPI_MAX_HZ; speed 0 runs as fast
+ * as the register writes go.  Slow transfers give the CPU up and look
+ * for signals between bytes.
+ *
+ *   insmod gpio-spi.ko sclk=21 mosi=20 miso=19 cs=26 bench_bytes=4096
+ *   mknod /dev/gpio-spi c 231 0
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/sched/signal.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
+
+#include "gpio-bcm.h"
+#include "gpio-spi.h"
+
+/*
+ * Debug option
+ */
+#define GPIO_SPI_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef GPIO_SPI_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[GPIO-SPI] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module major number */
+static int DEV_SPI_MAJOR_NUMBER = 231;
+/* Module name */
+#define DEV_SPI_NAME "gpio-spi"
+
+/* index into bb_spi.edge[][] for "leave MOSI as it is" */
+#define MOSI_KEEP 2
+
+/* from this half period on, reschedule and check signals every byte */
+#define BB_YIELD_HALF_NS 10000
+
+static unsigned int sclk = 21;
+module_param(sclk, uint, 0444);
+MODULE_PARM_DESC(sclk, "GPIO used as SCLK");
+
+static unsigned int mosi = 20;
+module_param(mosi, uint, 0444);
+MODULE_PARM_DESC(mosi, "GPIO used as MOSI");
+
+static unsigned int miso = 19;
+module_param(miso, uint, 0444);
+MODULE_PARM_DESC(miso, "GPIO used as MISO");
+
+static int cs = 26;
+module_param(cs, int, 0444);
+MODULE_PARM_DESC(cs, "GPIO used as active low chip select, -1 for none");
+
+static unsigned int speed_hz = GPIO_SPI_MAX_HZ;
+module_param(speed_hz, uint, 0444);
+MODULE_PARM_DESC(speed_hz, "Initial SCLK frequency in Hz (1000-500000), 0 for as fast as possible");
+
+static unsigned int bench_bytes;
+module_param(bench_bytes, uint, 0444);
+MODULE_PARM_DESC(bench_bytes, "Clock out this many bytes at load and report the rate");
+
+/* one half-cycle: what to set and clear in each bank */
+struct bb_edge {
+	unsigned int set[GPIO_BANKS];
+	unsigned int clr[GPIO_BANKS];
+};
+
+struct bb_spi {
+	/* serializes transfers and configuration */
+	struct mutex lock;
+	u32 mode;
+	u32 speed_hz;
+	/* half SCLK period in ns, 0 for no pacing */
+	u64 half_ns;
+	/* deadline of the next edge in ns on the System Timer */
+	u64 next_ns;
+	/* edge[sclk level][MOSI level or MOSI_KEEP] */
+	struct bb_edge edge[2][3];
+	/* MOSI latch as last written */
+	int mosi_level;
+	unsigned int miso_bank;
+	unsigned int miso_shift;
+	u8 tx[GPIO_SPI_MAX_XFER];
+	u8 rx[GPIO_SPI_MAX_XFER];
+};
+
+static struct bb_spi bb_dev;
+
+
+/* precompute the bank masks of all six SCLK/MOSI combinations */
+static void bb_build_edges(struct bb_spi *bb)
+{
+	unsigned int sclk_bank = sclk / 32, sclk_bit = 1U << (sclk % 32);
+	unsigned int mosi_bank = mosi / 32, mosi_bit = 1U << (mosi % 32);
+	int s, m;
+
+	memset(bb->edge, 0, sizeof(bb->edge));
+	for (s = 0; s < 2; s++) {
+		for (m = 0; m < 3; m++) {
+			struct bb_edge *e = &bb->edge[s][m];
+
+			if (s) {
+				e->set[sclk_bank] |= sclk_bit;
+			} else {
+				e->clr[sclk_bank] |= sclk_bit;
+			}
+			if (m == 1) {
+				e->set[mosi_bank] |= mosi_bit;
+			} else if (m == 0) {
+				e->clr[mosi_bank] |= mosi_bit;
+			}
+		}
+	}
+}
+
+static inline void bb_emit(const struct bb_edge *e)
+{
+	unsigned int bank;
+
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		gpio_set_mask(bank, e->set[bank]);
+		gpio_clr_mask(bank, e->clr[bank]);
+	}
+}
+
+/* start a new edge schedule from now */
+static void bb_sync(struct bb_spi *bb)
+{
+	bb->next_ns = get_time_stamp() * NSEC_PER_USEC;
+}
+
+/* wait until the next half period boundary, see gpio-i2c */
+static void bb_tick(struct bb_spi *bb)
+{
+	u64 now;
+
+	if (!bb->half_ns) {
+		return;
+	}
+
+	bb->next_ns += bb->half_ns;
+	while ((now = get_time_stamp() * NSEC_PER_USEC) < bb->next_ns)
+		;
+	if (now - bb->next_ns > bb->half_ns) {
+		bb->next_ns = now;
+	}
+}
+
+static int bb_set_speed(struct bb_spi *bb, u32 hz)
+{
+	if (hz && (hz < GPIO_SPI_MIN_HZ || hz > GPIO_SPI_MAX_HZ)) {
+		return -EINVAL;
+	}
+	bb->speed_hz = hz;
+	bb->half_ns = hz ? NSEC_PER_SEC / hz / 2 : 0;
+	return 0;
+}
+
+/* latch a new mode and park SCLK at its idle level */
+static void bb_set_mode(struct bb_spi *bb, u32 mode)
+{
+	bb->mode = mode;
+	bb_emit(&bb->edge[!!(mode & GPIO_SPI_CPOL)][MOSI_KEEP]);
+}
+
+/*
+ * Full duplex transfer of len bytes, MSB first.
+ * The first half-cycle of each bit drives MOSI (together with the
+ * trailing edge for CPHA=1), the second one is the sampling edge.
+ * -EINTR if a signal came in between two bytes of a slow transfer.
+ */
+static int bb_xfer(struct bb_spi *bb, const u8 *tx, u8 *rx, unsigned int len)
+{
+	int cpol = !!(bb->mode & GPIO_SPI_CPOL);
+	int cpha = !!(bb->mode & GPIO_SPI_CPHA);
+	/* SCLK level after the first and second half of a bit */
+	int lvl1 = cpha ? !cpol : cpol;
+	int lvl2 = !lvl1;
+	const struct bb_edge *sample_edge = &bb->edge[lvl2][MOSI_KEEP];
+	unsigned int miso_bank = bb->miso_bank, miso_shift = bb->miso_shift;
+	unsigned int i;
+	int b, ret = 0;
+
+	if (cs >= 0) {
+		set_pin(cs, S_OFF);
+	}
+	bb_sync(bb);
+
+	for (i = 0; i < len; i++) {
+		u8 out = tx[i], in = 0;
+
+		/* SPI is clocked by us, a pause between bytes is harmless */
+		if (i && bb->half_ns >= BB_YIELD_HALF_NS) {
+			if (signal_pending(current)) {
+				ret = -EINTR;
+				break;
+			}
+			cond_resched();
+			bb_sync(bb);
+		}
+
+		for (b = 7; b >= 0; b--) {
+			int bit = (out >> b) & 1;
+
+			bb_emit(&bb->edge[lvl1][bit == bb->mosi_level ? MOSI_KEEP : bit]);
+			bb->mosi_level = bit;
+			bb_tick(bb);
+
+			in = (in << 1) | ((gpio_get_levels(miso_bank) >> miso_shift) & 1);
+			bb_emit(sample_edge);
+			bb_tick(bb);
+		}
+		rx[i] = in;
+	}
+
+	/* CPHA=0 ends on the sampling edge, bring SCLK back to idle */
+	if (lvl2 != cpol) {
+		bb_emit(&bb->edge[cpol][MOSI_KEEP]);
+		bb_tick(bb);
+	}
+
+	if (cs >= 0) {
+		set_pin(cs, S_ON);
+	}
+	return ret;
+}
+
+/* clock out bytes of 0x55 and report the achieved bit rate */
+static int bb_benchmark(struct bb_spi *bb, struct gpio_spi_bench *bench)
+{
+	unsigned int left = bench->bytes, chunk;
+	u64 start;
+#ifdef GPIO_BCM_SIMULATE
+	unsigned long stores = gpio_sim_stores;
+#endif
+
+	memset(bb->tx, 0x55, sizeof(bb->tx));
+	start = ktime_get_ns();
+	while (left) {
+		chunk = min_t(unsigned int, left, GPIO_SPI_MAX_XFER);
+		if (bb_xfer(bb, bb->tx, bb->rx, chunk)) {
+			return -EINTR;
+		}
+		left -= chunk;
+		/* the device lock is held, let a long run be interrupted */
+		if (left && signal_pending(current)) {
+			return -EINTR;
+		}
+		cond_resched();
+	}
+	bench->elapsed_ns = ktime_get_ns() - start;
+	bench->bits_per_sec = bench->elapsed_ns ?
+		div64_u64((u64)bench->bytes * 8 * NSEC_PER_SEC, bench->elapsed_ns) : 0;
+#ifdef GPIO_BCM_SIMULATE
+	bench->stores = gpio_sim_stores - stores;
+#else
+	bench->stores = 0;
+#endif
+	return 0;
+}
+
+
+static int spi_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = &bb_dev;
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static int spi_release(struct inode *inode, struct file *filp)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static long spi_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct bb_spi *bb = filp->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct gpio_spi_xfer xfer;
+	struct gpio_spi_bench bench;
+	u64 start;
+	u32 val;
+	long ret = 0;
+
+	if (mutex_lock_interruptible(&bb->lock)) {
+		return -ERESTARTSYS;
+	}
+
+	switch (cmd) {
+	case GPIO_SPI_IOC_MODE:
+		if (get_user(val, (u32 __user *)uarg)) {
+			ret = -EFAULT;
+		} else if (val > (GPIO_SPI_CPOL | GPIO_SPI_CPHA)) {
+			ret = -EINVAL;
+		} else {
+			bb_set_mode(bb, val);
+		}
+		break;
+
+	case GPIO_SPI_IOC_SPEED:
+		if (get_user(val, (u32 __user *)uarg)) {
+			ret = -EFAULT;
+		} else {
+			ret = bb_set_speed(bb, val);
+		}
+		break;
+
+	case GPIO_SPI_IOC_XFER:
+		if (copy_from_user(&xfer, uarg, sizeof(xfer))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (xfer.len == 0 || xfer.len > GPIO_SPI_MAX_XFER) {
+			ret = -EINVAL;
+			break;
+		}
+		if (!xfer.tx) {
+			memset(bb->tx, 0, xfer.len);
+		} else if (copy_from_user(bb->tx, u64_to_user_ptr(xfer.tx), xfer.len)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		start = ktime_get_ns();
+		ret = bb_xfer(bb, bb->tx, bb->rx, xfer.len);
+		if (ret) {
+			break;
+		}
+		xfer.elapsed_ns = ktime_get_ns() - start;
+
+		if (xfer.rx && copy_to_user(u64_to_user_ptr(xfer.rx), bb->rx, xfer.len)) {
+			ret = -EFAULT;
+		} else if (copy_to_user(uarg, &xfer, sizeof(xfer))) {
+			ret = -EFAULT;
+		}
+		break;
+
+	case GPIO_SPI_IOC_BENCH:
+		if (copy_from_user(&bench, uarg, sizeof(bench))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (bench.bytes > GPIO_SPI_MAX_BENCH) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = bb_benchmark(bb, &bench);
+		if (ret) {
+			break;
+		}
+		if (copy_to_user(uarg, &bench, sizeof(bench))) {
+			ret = -EFAULT;
+		}
+		break;
+
+	default:
+		ret = -ENOTTY;
+	}
+
+	mutex_unlock(&bb->lock);
+	return ret;
+}
+
+static struct file_operations spi_fops = {
+	.owner = THIS_MODULE,
+	.open = spi_open,
+	.release = spi_release,
+	.unlocked_ioctl = spi_ioctl
+};
+
+
+static int gpio_spi_init(void)
+{
+	struct bb_spi *bb = &bb_dev;
+	struct gpio_spi_bench bench = { .bytes = bench_bytes };
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	/* registers are mapped by gpio-bcm */
+	if (gpio_bcm_ready()) {
+		return -ENODEV;
+	}
+
+	if (sclk > GPIO_MAX_PIN || mosi > GPIO_MAX_PIN || miso > GPIO_MAX_PIN ||
+	    cs > GPIO_MAX_PIN || sclk == mosi || sclk == miso || mosi == miso) {
+		return -EINVAL;
+	}
+
+	mutex_init(&bb->lock);
+	bb_build_edges(bb);
+	bb->miso_bank = miso / 32;
+	bb->miso_shift = miso % 32;
+	if (bb_set_speed(bb, speed_hz)) {
+		return -EINVAL;
+	}
+
+	/* latch the idle levels before turning the pins into outputs */
+	bb_set_mode(bb, 0);
+	set_pin(mosi, S_OFF);
+	bb->mosi_level = 0;
+	func_pin(sclk, M_OUTPUT);
+	func_pin(mosi, M_OUTPUT);
+	func_pin(miso, M_INPUT);
+	if (cs >= 0) {
+		set_pin(cs, S_ON);
+		func_pin(cs, M_OUTPUT);
+	}
+
+	if (bench_bytes && !bb_benchmark(bb, &bench)) {
+		printk(KERN_INFO "[GPIO-SPI] %u bytes in %llu ns: %llu bit/s (target %u Hz), %llu stores\n",
+		       bench.bytes, bench.elapsed_ns, bench.bits_per_sec,
+		       speed_hz, bench.stores);
+	}
+
+	ret = register_chrdev(DEV_SPI_MAJOR_NUMBER, DEV_SPI_NAME, &spi_fops);
+	if (ret < 0) {
+		return ret;
+	}
+	return 0;
+}
+
+static void gpio_spi_exit(void)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	unregister_chrdev(DEV_SPI_MAJOR_NUMBER, DEV_SPI_NAME);
+	func_pin(sclk, M_INPUT);
+	func_pin(mosi, M_INPUT);
+	if (cs >= 0) {
+		func_pin(cs, M_INPUT);
+	}
+}
+
+
+module_init(gpio_spi_init);
+module_exit(gpio_spi_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Bit-banged SPI master on BCM2837 GPIO");
@@ -0,0 +1,61 @@
+/*
+ * GPIO-SPI ioctl interface, shared by the driver and user programs
+ */
+#ifndef GPIO_SPI_H
+#define GPIO_SPI_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+#endif
+
+/* largest single transfer */
+#define GPIO_SPI_MAX_XFER 4096
+
+/*
+ * GPIO_SPI_IOC_SPEED range, 0 aside: edges are timed on the 1 us System
+ * Timer, so a half period of at least one tick; slow clocks make every
+ * transfer long enough to need a lower bound
+ */
+#define GPIO_SPI_MIN_HZ 1000
+#define GPIO_SPI_MAX_HZ 500000
+
+/* largest GPIO_SPI_IOC_BENCH run */
+#define GPIO_SPI_MAX_BENCH (1U << 20)
+
+/* SPI mode bits, same meaning as SPI_CPHA / SPI_CPOL */
+#define GPIO_SPI_CPHA 0x01
+#define GPIO_SPI_CPOL 0x02
+
+/* full duplex transfer of len bytes; rx may be 0 to drop MISO */
+struct gpio_spi_xfer {
+	__u64 tx;
+	__u64 rx;
+	__u32 len;
+	/* out: time the transfer took */
+	__u32 elapsed_ns;
+};
+
+/* clock out bytes dummy bytes and report the achieved rate */
+struct gpio_spi_bench {
+	__u32 bytes;
+	__u32 reserved;
+	/* out */
+	__u64 elapsed_ns;
+	__u64 bits_per_sec;
+	/* register stores issued, counted on the simulated backend only */
+	__u64 stores;
+};
+
+#define GPIO_SPI_IOC_MAGIC 's'
+#define GPIO_SPI_IOC_MODE _IOW(GPIO_SPI_IOC_MAGIC, 1, __u32)
+#define GPIO_SPI_IOC_SPEED _IOW(GPIO_SPI_IOC_MAGIC, 2, __u32)
+#define GPIO_SPI_IOC_XFER _IOWR(GPIO_SPI_IOC_MAGIC, 3, struct gpio_spi_xfer)
+#define GPIO_SPI_IOC_BENCH _IOWR(GPIO_SPI_IOC_MAGIC, 4, struct gpio_spi_bench)
+
+#endif /* GPIO_SPI_H */
@@ -0,0 +1,788 @@
+/*
+ * GPIO-WAVE - timed edge playback on a group of GPIO pins
+ *
+ * Edges written to the device (see gpio-wave.h) go through a single
+ * producer, single consumer kfifo to one of two playback engines:
+ *
+ *   - hrtimer: an absolute hrtimer per edge.  Costs nothing between
+ *     edges, but every edge is as late as the timer interrupt and the
+ *     callback make it, several microseconds and more under load.
+ *   - rt: a SCHED_FIFO kernel thread bound to cpu= that spins on the
+ *     System Timer from edge to edge, so an edge is stored within the
+ *     tick it is due.  It only spins while a waveform is playing and
+ *     parks in between.  Meant for a CPU taken out of the scheduler
+ *     with isolcpus= (and nohz_full=), it otherwise starves that CPU.
+ *
+ * Writers never take a lock the engines use: the kfifo is lockless for
+ * one reader and one writer, writers are serialized by a mutex, and the
+ * engine is kicked through the running flag, see wave_kick().
+ *
+ * Uploaded waveforms live in two buffers of buf_edges edges.  Their
+ * states (free, loading, ready, playing) share one atomic word, so the
+ * engine retires the buffer it played and takes up the ready one in a
+ * single cmpxchg, and an upload never touches the playing buffer.  A
+ * pass follows the previous one on the same deadline chain: the loop
+ * period is exactly the sum of its deltas, with no gap at the seams.
+ *
+ *   insmod gpio-wave.ko pins=16,20,21 cpu=3 engine=1
+ *   mknod /dev/gpio-wave c 235 0
+ *
+ * bench_edges plays that many toggles of pins[0], bench_period_us apart,
+ * on each engine at load and reports how late they were.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+
+#include "gpio-bcm.h"
+#include "gpio-wave.h"
+
+/*
+ * Debug option
+ */
+#define GPIO_WAVE_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef GPIO_WAVE_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[GPIO-WAVE] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module major number */
+static int DEV_WAVE_MAJOR_NUMBER = 235;
+/* Module name */
+#define DEV_WAVE_NAME "gpio-wave"
+
+/* queued edges, must be a power of two */
+#define WAVE_QUEUE_EDGES 4096
+
+/* the rt engine lets the scheduler in while an edge is further away */
+#define WAVE_RESCHED_US 1000
+
+/*
+ * most edges the hrtimer engine stores in one expiry; when still behind
+ * after that it re-arms WAVE_TIMER_YIELD_US out rather than spinning on
+ * in hard interrupt context
+ */
+#define WAVE_TIMER_BURST 64
+#define WAVE_TIMER_YIELD_US 20
+
+/* shortest period of a looped upload, per edge */
+#define WAVE_LOOP_MIN_US 1
+
+/* uploaded waveform buffers and their states, 2 bits each in wave.bufs */
+#define WAVE_BUFS 2
+#define WAVE_FREE 0
+#define WAVE_LOADING 1
+#define WAVE_READY 2
+#define WAVE_PLAYING 3
+#define WAVE_STATE(s, b) (((s) >> ((b) * 2)) & 0x03)
+#define WAVE_WITH(s, b, v) (((s) & ~(0x03 << ((b) * 2))) | ((v) << ((b) * 2)))
+
+static unsigned int pins[GPIO_GROUP_MAX] = { 16 };
+static unsigned int npins = 1;
+module_param_array(pins, uint, &npins, 0444);
+MODULE_PARM_DESC(pins, "Output pins the edges may drive");
+
+static int cpu = -1;
+module_param(cpu, int, 0444);
+MODULE_PARM_DESC(cpu, "CPU of the rt engine thread, -1 disables the rt engine");
+
+static unsigned int engine = GPIO_WAVE_ENGINE_HRTIMER;
+module_param(engine, uint, 0444);
+MODULE_PARM_DESC(engine, "Engine at load, 0 hrtimer, 1 rt");
+
+static unsigned int lead_us = 1000;
+module_param(lead_us, uint, 0444);
+MODULE_PARM_DESC(lead_us, "Delay from the first queued edge to playback start");
+
+static unsigned int buf_edges = 16384;
+module_param(buf_edges, uint, 0444);
+MODULE_PARM_DESC(buf_edges, "Edges per uploaded waveform");
+
+static unsigned int bench_edges;
+module_param(bench_edges, uint, 0444);
+MODULE_PARM_DESC(bench_edges, "Play this many edges on each engine at load and report their timing");
+
+static unsigned int bench_period_us = 100;
+module_param(bench_period_us, uint, 0444);
+MODULE_PARM_DESC(bench_period_us, "Edge spacing of the benchmark");
+
+struct wave_buf {
+	struct gpio_wave_edge *edges;
+	unsigned int count;
+	unsigned int repeat;
+	unsigned int flags;
+};
+
+struct wave {
+	/* serializes writers and engine changes */
+	struct mutex lock;
+	DECLARE_KFIFO(queue, struct gpio_wave_edge, WAVE_QUEUE_EDGES);
+	/* writers waiting for room, and for playback to end */
+	wait_queue_head_t space;
+	struct gpio_group group;
+	unsigned int engine;
+	/* 1 from wave_kick() until the engine drains the queue */
+	atomic_t running;
+	struct wave_buf buf[WAVE_BUFS];
+	/* WAVE_FREE... of each buffer */
+	atomic_t bufs;
+
+	/* consumer side, only touched by the engine */
+	struct gpio_wave_edge cur;
+	bool pending;
+	/* System Timer deadline of cur */
+	u64 deadline_us;
+	/* buffer playing or -1, next edge in it and passes left */
+	int play;
+	unsigned int pos;
+	unsigned int left;
+	struct gpio_wave_stats st;
+
+	/* hrtimer engine */
+	struct hrtimer timer;
+
+	/* rt engine */
+	struct task_struct *thread;
+};
+
+static struct wave wave_dev;
+
+
+/* store e, due at w->deadline_us, and account how late it is */
+static void wave_apply(struct wave *w, const struct gpio_wave_edge *e, u64 now)
+{
+	struct gpio_wave_stats *st = &w->st;
+	u64 late = now - w->deadline_us;
+	unsigned int bank;
+
+	for (bank = 0; bank < GPIO_BANKS; bank++) {
+		gpio_set_mask(bank, e->set[bank] & w->group.mask[bank]);
+		gpio_clr_mask(bank, e->clr[bank] & w->group.mask[bank]);
+	}
+
+	st->edges++;
+	st->late_sum_us += late;
+	if (late > st->late_max_us) {
+		st->late_max_us = late;
+	}
+	st->hist[min_t(unsigned int, fls64(late), GPIO_WAVE_HIST - 1)]++;
+}
+
+/*
+ * consumer: retire the playing buffer and play the ready one instead
+ * Returns false and leaves everything as it is when none is ready.
+ */
+static bool wave_swap(struct wave *w)
+{
+	int s, n, b;
+
+	do {
+		s = atomic_read(&w->bufs);
+		for (b = 0; b < WAVE_BUFS; b++) {
+			if (WAVE_STATE(s, b) == WAVE_READY) {
+				break;
+			}
+		}
+		if (b == WAVE_BUFS) {
+			return false;
+		}
+		n = WAVE_WITH(s, b, WAVE_PLAYING);
+		if (w->play >= 0) {
+			n = WAVE_WITH(n, w->play, WAVE_FREE);
+		}
+	} while (atomic_cmpxchg(&w->bufs, s, n) != s);
+
+	w->play = b;
+	w->pos = 0;
+	w->left = w->buf[b].repeat;
+	return true;
+}
+
+/* consumer: next edge of the uploaded waveforms, false if none plays */
+static bool wave_next_buf(struct wave *w, struct gpio_wave_edge *e)
+{
+	const struct wave_buf *wb;
+
+	if (w->play >= 0 && w->pos == w->buf[w->play].count) {
+		wb = &w->buf[w->play];
+		w->st.passes++;
+		w->pos = 0;
+		if (wb->repeat == 0) {
+			/* looping: give way to a newer upload after each pass */
+			wave_swap(w);
+		} else if (--w->left == 0 && !wave_swap(w)) {
+			if (wb->flags & GPIO_WAVE_CHAIN) {
+				w->st.underruns++;
+			}
+			/* done reading it before the upload may reuse it */
+			smp_mb__before_atomic();
+			atomic_andnot(0x03 << (w->play * 2), &w->bufs);
+			w->play = -1;
+		}
+	}
+	if (w->play < 0 && !wave_swap(w)) {
+		return false;
+	}
+
+	*e = w->buf[w->play].edges[w->pos++];
+	return true;
+}
+
+/* anything for the engine to play */
+static bool wave_ready(struct wave *w)
+{
+	int s = atomic_read(&w->bufs), b;
+
+	for (b = 0; b < WAVE_BUFS; b++) {
+		if (WAVE_STATE(s, b) == WAVE_READY) {
+			return true;
+		}
+	}
+	return !kfifo_is_empty(&w->queue);
+}
+
+/*
+ * take the next edge, false when there is nothing left and playback ended
+ * Clearing running and re-checking for work pairs with wave_kick(): a
+ * writer either sees running cleared and kicks us again, or we see its
+ * edges or upload here.
+ */
+static bool wave_next(struct wave *w, struct gpio_wave_edge *e)
+{
+	if (wave_next_buf(w, e)) {
+		return true;
+	}
+	if (kfifo_get(&w->queue, e)) {
+		if (kfifo_len(&w->queue) == WAVE_QUEUE_EDGES / 2) {
+			wake_up_interruptible(&w->space);
+		}
+		return true;
+	}
+
+	atomic_set(&w->running, 0);
+	smp_mb();
+	if (wave_ready(w) && atomic_cmpxchg(&w->running, 0, 1) == 0) {
+		return wave_next_buf(w, e) || kfifo_get(&w->queue, e);
+	}
+	wake_up_interruptible(&w->space);
+	return false;
+}
+
+static enum hrtimer_restart wave_timer(struct hrtimer *t)
+{
+	struct wave *w = container_of(t, struct wave, timer);
+	u64 now = get_time_stamp();
+	unsigned int burst = 0;
+
+	if (!w->pending) {
+		/* kicked by wave_kick(): the waveform starts now */
+		w->deadline_us = now;
+	}
+
+	/* store every edge that is due, then sleep until the next one */
+	while (!w->pending || now >= w->deadline_us) {
+		if (burst++ == WAVE_TIMER_BURST) {
+			hrtimer_set_expires(t, ktime_add_us(ktime_get(), WAVE_TIMER_YIELD_US));
+			return HRTIMER_RESTART;
+		}
+		if (w->pending) {
+			wave_apply(w, &w->cur, now);
+		}
+		w->pending = wave_next(w, &w->cur);
+		if (!w->pending) {
+			return HRTIMER_NORESTART;
+		}
+		w->deadline_us += w->cur.delta_us;
+		now = get_time_stamp();
+	}
+
+	/*
+	 * the deadlines are on the System Timer, the hrtimer on the slewed
+	 * CLOCK_MONOTONIC: arm each expiry from both clocks read now, so
+	 * they cannot drift apart over a long playback
+	 */
+	hrtimer_set_expires(t, ktime_add_us(ktime_get(), w->deadline_us - now));
+	return HRTIMER_RESTART;
+}
+
+/* spin until the System Timer reaches deadline_us, stop early if asked to */
+static u64 wave_spin(u64 deadline_us)
+{
+	u64 now;
+
+	while ((now = get_time_stamp()) < deadline_us) {
+		if (kthread_should_stop()) {
+			break;
+		}
+		if (deadline_us - now > WAVE_RESCHED_US) {
+			cond_resched();
+		}
+	}
+	return now;
+}
+
+static int wave_thread(void *data)
+{
+	struct wave *w = data;
+	u64 now;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!atomic_read(&w->running)) {
+			/* parked until wave_kick() */
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		/* spin from edge to edge until the queue drains */
+		w->deadline_us = get_time_stamp() + lead_us;
+		while (wave_next(w, &w->cur)) {
+			w->deadline_us += w->cur.delta_us;
+			now = wave_spin(w->deadline_us);
+			if (kthread_should_stop()) {
+				return 0;
+			}
+			wave_apply(w, &w->cur, now);
+		}
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/* start the engine on new edges or waveforms unless it is already playing */
+static void wave_kick(struct wave *w)
+{
+	/* order the new data before the running check, see wave_next() */
+	smp_mb();
+	if (atomic_cmpxchg(&w->running, 0, 1) != 0) {
+		return;
+	}
+
+	if (w->engine == GPIO_WAVE_ENGINE_RT) {
+		wake_up_process(w->thread);
+	} else {
+		hrtimer_start(&w->timer, ns_to_ktime((u64)lead_us * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	}
+}
+
+/* stop playback and drop the queue and the uploads; w->lock held */
+static void wave_halt(struct wave *w)
+{
+	if (w->thread) {
+		kthread_stop(w->thread);
+		w->thread = NULL;
+	}
+	hrtimer_cancel(&w->timer);
+
+	/* no consumer left, so the reset cannot race */
+	kfifo_reset(&w->queue);
+	atomic_set(&w->bufs, 0);
+	w->play = -1;
+	w->pending = false;
+	atomic_set(&w->running, 0);
+	wake_up_interruptible(&w->space);
+}
+
+/* halt and restart on engine id; w->lock held */
+static int wave_set_engine(struct wave *w, unsigned int id)
+{
+	struct task_struct *t;
+
+	if (id != GPIO_WAVE_ENGINE_HRTIMER && id != GPIO_WAVE_ENGINE_RT) {
+		return -EINVAL;
+	}
+	if (id == GPIO_WAVE_ENGINE_RT && cpu < 0) {
+		return -EINVAL;
+	}
+
+	wave_halt(w);
+	w->engine = GPIO_WAVE_ENGINE_HRTIMER;
+	memset(&w->st, 0, sizeof(w->st));
+
+	if (id == GPIO_WAVE_ENGINE_RT) {
+		t = kthread_create(wave_thread, w, "gpio-wave");
+		if (IS_ERR(t)) {
+			return PTR_ERR(t);
+		}
+		kthread_bind(t, cpu);
+		sched_set_fifo(t);
+		w->thread = t;
+		wake_up_process(t);
+	}
+	w->engine = id;
+	w->st.engine = id;
+	return 0;
+}
+
+/*
+ * take w->lock with room for at least one edge in the queue
+ * Returns with the lock dropped on error.
+ */
+static int wave_lock_space(struct wave *w, bool nonblock)
+{
+	if (mutex_lock_interruptible(&w->lock)) {
+		return -ERESTARTSYS;
+	}
+	while (kfifo_is_full(&w->queue)) {
+		mutex_unlock(&w->lock);
+		if (nonblock) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(w->space, !kfifo_is_full(&w->queue))) {
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&w->lock)) {
+			return -ERESTARTSYS;
+		}
+	}
+	return 0;
+}
+
+/*
+ * upload ld into a buffer the engine is not playing and mark it ready
+ * With one buffer playing and the other ready, the ready one is taken
+ * back and overwritten.  w->lock held.
+ */
+static int wave_load(struct wave *w, const struct gpio_wave_load *ld)
+{
+	struct wave_buf *wb;
+	u64 period_us = 0;
+	unsigned int i;
+	int s, n, b;
+
+	if (ld->count == 0 || ld->count > buf_edges || (ld->flags & ~GPIO_WAVE_CHAIN)) {
+		return -EINVAL;
+	}
+
+	/* the engine holds at most one buffer, so one is free or ready */
+	do {
+		s = atomic_read(&w->bufs);
+		for (b = 0; b < WAVE_BUFS; b++) {
+			if (WAVE_STATE(s, b) == WAVE_FREE) {
+				break;
+			}
+		}
+		if (b == WAVE_BUFS) {
+			for (b = 0; b < WAVE_BUFS; b++) {
+				if (WAVE_STATE(s, b) == WAVE_READY) {
+					break;
+				}
+			}
+		}
+		n = WAVE_WITH(s, b, WAVE_LOADING);
+	} while (atomic_cmpxchg(&w->bufs, s, n) != s);
+
+	wb = &w->buf[b];
+	if (copy_from_user(wb->edges, u64_to_user_ptr(ld->edges),
+			   (size_t)ld->count * sizeof(*wb->edges))) {
+		atomic_andnot(0x03 << (b * 2), &w->bufs);
+		return -EFAULT;
+	}
+
+	/* a loop that takes no time would never let the engine go */
+	if (ld->repeat == 0) {
+		for (i = 0; i < ld->count; i++) {
+			period_us += wb->edges[i].delta_us;
+		}
+		if (period_us < (u64)ld->count * WAVE_LOOP_MIN_US) {
+			atomic_andnot(0x03 << (b * 2), &w->bufs);
+			return -EINVAL;
+		}
+	}
+	wb->count = ld->count;
+	wb->repeat = ld->repeat;
+	wb->flags = ld->flags;
+
+	/* LOADING to READY, once the edges are visible */
+	smp_mb__before_atomic();
+	atomic_xor((WAVE_LOADING ^ WAVE_READY) << (b * 2), &w->bufs);
+	wave_kick(w);
+	return 0;
+}
+
+/* queue one edge from the kernel, waiting for room */
+static int wave_push(struct wave *w, const struct gpio_wave_edge *e)
+{
+	int ret = wave_lock_space(w, false);
+
+	if (ret) {
+		return ret;
+	}
+	kfifo_put(&w->queue, *e);
+	wave_kick(w);
+	mutex_unlock(&w->lock);
+	return 0;
+}
+
+/* mean, worst and 99th percentile lateness of one benchmark run */
+static void wave_report(const char *name, const struct gpio_wave_stats *st)
+{
+	u64 sum = 0, mean;
+	unsigned int b;
+
+	for (b = 0; b < GPIO_WAVE_HIST - 1; b++) {
+		sum += st->hist[b];
+		if (sum * 100 >= st->edges * 99) {
+			break;
+		}
+	}
+	mean = st->edges ? div64_u64(st->late_sum_us * 100, st->edges) : 0;
+
+	printk(KERN_INFO "[GPIO-WAVE] %s: %llu edges, late mean %llu.%02llu us, max %llu us, 99%% within %llu us\n",
+	       name, st->edges, div_u64(mean, 100), mean % 100, st->late_max_us,
+	       (1ULL << b) - 1);
+}
+
+static void wave_benchmark_engine(struct wave *w, unsigned int id, const char *name)
+{
+	struct gpio_wave_edge e = { .delta_us = bench_period_us };
+	unsigned int bank = w->group.pins[0] / 32, bit = 1U << (w->group.pins[0] % 32);
+	unsigned int i;
+	int ret;
+
+	mutex_lock(&w->lock);
+	ret = wave_set_engine(w, id);
+	mutex_unlock(&w->lock);
+	if (ret) {
+		return;
+	}
+
+	for (i = 0; i < bench_edges; i++) {
+		e.set[bank] = i & 1 ? 0 : bit;
+		e.clr[bank] = i & 1 ? bit : 0;
+		if (wave_push(w, &e)) {
+			return;
+		}
+	}
+	if (wait_event_interruptible(w->space, !atomic_read(&w->running))) {
+		return;
+	}
+	wave_report(name, &w->st);
+}
+
+static void wave_benchmark(struct wave *w)
+{
+	wave_benchmark_engine(w, GPIO_WAVE_ENGINE_HRTIMER, "hrtimer");
+	if (cpu >= 0) {
+		wave_benchmark_engine(w, GPIO_WAVE_ENGINE_RT, "rt");
+	}
+}
+
+
+static int wave_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = &wave_dev;
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static int wave_release(struct inode *inode, struct file *filp)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+/* queue whole edges; blocks while the queue is full */
+static ssize_t wave_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct wave *w = filp->private_data;
+	unsigned int copied;
+	int ret;
+
+	count -= count % sizeof(struct gpio_wave_edge);
+	if (count == 0) {
+		return -EINVAL;
+	}
+
+	ret = wave_lock_space(w, filp->f_flags & O_NONBLOCK);
+	if (ret) {
+		return ret;
+	}
+	ret = kfifo_from_user(&w->queue, buf, count, &copied);
+	if (copied) {
+		wave_kick(w);
+	}
+	mutex_unlock(&w->lock);
+
+	return copied ? copied : ret;
+}
+
+static long wave_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct wave *w = filp->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct gpio_wave_edge e;
+	struct gpio_wave_stats st;
+	struct gpio_wave_load ld;
+	__u32 id;
+	long ret;
+
+	switch (cmd) {
+	case GPIO_WAVE_IOC_ENGINE:
+		if (get_user(id, (__u32 __user *)uarg)) {
+			return -EFAULT;
+		}
+		if (mutex_lock_interruptible(&w->lock)) {
+			return -ERESTARTSYS;
+		}
+		ret = wave_set_engine(w, id);
+		mutex_unlock(&w->lock);
+		return ret;
+
+	case GPIO_WAVE_IOC_EDGE:
+		if (copy_from_user(&e, uarg, sizeof(e))) {
+			return -EFAULT;
+		}
+		ret = wave_lock_space(w, filp->f_flags & O_NONBLOCK);
+		if (ret) {
+			return ret;
+		}
+		kfifo_put(&w->queue, e);
+		wave_kick(w);
+		mutex_unlock(&w->lock);
+		return 0;
+
+	case GPIO_WAVE_IOC_STATS:
+		memcpy(&st, &w->st, sizeof(st));
+		return copy_to_user(uarg, &st, sizeof(st)) ? -EFAULT : 0;
+
+	case GPIO_WAVE_IOC_STOP:
+		if (mutex_lock_interruptible(&w->lock)) {
+			return -ERESTARTSYS;
+		}
+		ret = wave_set_engine(w, w->engine);
+		mutex_unlock(&w->lock);
+		return ret;
+
+	case GPIO_WAVE_IOC_LOAD:
+		if (copy_from_user(&ld, uarg, sizeof(ld))) {
+			return -EFAULT;
+		}
+		if (mutex_lock_interruptible(&w->lock)) {
+			return -ERESTARTSYS;
+		}
+		ret = wave_load(w, &ld);
+		mutex_unlock(&w->lock);
+		return ret;
+	}
+	return -ENOTTY;
+}
+
+static struct file_operations wave_fops = {
+	.owner = THIS_MODULE,
+	.open = wave_open,
+	.release = wave_release,
+	.write = wave_write,
+	.unlocked_ioctl = wave_ioctl
+};
+
+
+static void wave_free_bufs(struct wave *w)
+{
+	unsigned int b;
+
+	for (b = 0; b < WAVE_BUFS; b++) {
+		vfree(w->buf[b].edges);
+		w->buf[b].edges = NULL;
+	}
+}
+
+static int gpio_wave_init(void)
+{
+	struct wave *w = &wave_dev;
+	unsigned int b;
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	/* registers are mapped by gpio-bcm */
+	if (gpio_bcm_ready()) {
+		return -ENODEV;
+	}
+
+	if (cpu >= (int)nr_cpu_ids || buf_edges == 0) {
+		return -EINVAL;
+	}
+	if (gpio_group_init(&w->group, pins, npins) != 0) {
+		return -EINVAL;
+	}
+
+	for (b = 0; b < WAVE_BUFS; b++) {
+		w->buf[b].edges = vmalloc_array(buf_edges, sizeof(struct gpio_wave_edge));
+		if (!w->buf[b].edges) {
+			wave_free_bufs(w);
+			return -ENOMEM;
+		}
+	}
+
+	mutex_init(&w->lock);
+	INIT_KFIFO(w->queue);
+	init_waitqueue_head(&w->space);
+	atomic_set(&w->bufs, 0);
+	w->play = -1;
+	hrtimer_setup(&w->timer, wave_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+
+	gpio_group_write(&w->group, 0);
+	gpio_group_func(&w->group, M_OUTPUT);
+
+	if (bench_edges) {
+		wave_benchmark(w);
+	}
+
+	mutex_lock(&w->lock);
+	ret = wave_set_engine(w, engine);
+	mutex_unlock(&w->lock);
+	if (ret) {
+		gpio_group_func(&w->group, M_INPUT);
+		wave_free_bufs(w);
+		return ret;
+	}
+
+	ret = register_chrdev(DEV_WAVE_MAJOR_NUMBER, DEV_WAVE_NAME, &wave_fops);
+	if (ret < 0) {
+		wave_halt(w);
+		gpio_group_func(&w->group, M_INPUT);
+		wave_free_bufs(w);
+		return ret;
+	}
+	return 0;
+}
+
+static void gpio_wave_exit(void)
+{
+	struct wave *w = &wave_dev;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	unregister_chrdev(DEV_WAVE_MAJOR_NUMBER, DEV_WAVE_NAME);
+	wave_halt(w);
+	gpio_group_func(&w->group, M_INPUT);
+	wave_free_bufs(w);
+	PDEBUG("engine %u: edges %llu, late max %llu us, passes %llu, underruns %llu\n",
+	       w->st.engine, w->st.edges, w->st.late_max_us, w->st.passes, w->st.underruns);
+}
+
+
+module_init(gpio_wave_init);
+module_exit(gpio_wave_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Timed edge playback on BCM2837 GPIO");
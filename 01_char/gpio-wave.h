@@ -0,0 +1,91 @@
+/*
+ * GPIO-WAVE edge format and ioctl interface
+ *
+ * write() takes whole struct gpio_wave_edge records.  Each record waits
+ * delta_us on the System Timer after the previous one (after playback
+ * start for the first) and then drives its pins: the set masks first,
+ * then the clear masks, one GPSET and one GPCLR store per bank.  Pins
+ * outside of the device's pins= are ignored.
+ *
+ * Playback runs while edges are queued and ends when the queue runs dry;
+ * the next write starts a new waveform.
+ *
+ * Waveforms can also be uploaded whole with GPIO_WAVE_IOC_LOAD into one
+ * of two buffers and played repeat times, or looped.  While one buffer
+ * plays the other takes the next upload, which follows without a gap:
+ * a looping waveform gives way at the end of its current pass, a counted
+ * one after its last pass.  Uploading again before the pending waveform
+ * started replaces it.  Queued edges play when no buffer does.
+ */
+#ifndef GPIO_WAVE_H
+#define GPIO_WAVE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+#endif
+
+struct gpio_wave_edge {
+	/* System Timer microseconds after the previous edge */
+	__u32 delta_us;
+	/* pins to drive high and low, per bank */
+	__u32 set[2];
+	__u32 clr[2];
+};
+
+/* playback engines */
+#define GPIO_WAVE_ENGINE_HRTIMER 0
+/* SCHED_FIFO thread spinning on the System Timer, needs cpu= */
+#define GPIO_WAVE_ENGINE_RT 1
+
+/* gpio_wave_load.flags: another waveform is meant to follow this one */
+#define GPIO_WAVE_CHAIN 0x01
+
+struct gpio_wave_load {
+	/* user pointer to count struct gpio_wave_edge */
+	__u64 edges;
+	__u32 count;
+	/*
+	 * passes to play, 0 loops until replaced or stopped; a loop must
+	 * last at least 1 us per edge, or the upload fails with EINVAL
+	 */
+	__u32 repeat;
+	__u32 flags;
+	__u32 reserved;
+};
+
+#define GPIO_WAVE_HIST 16
+
+/* timing of the edges played since the engine was selected */
+struct gpio_wave_stats {
+	__u32 engine;
+	__u32 reserved;
+	__u64 edges;
+	/* how late the edges were stored, System Timer microseconds */
+	__u64 late_sum_us;
+	__u64 late_max_us;
+	/* hist[0]: on time, hist[n]: 2^(n-1) to 2^n - 1 us late */
+	__u64 hist[GPIO_WAVE_HIST];
+	/* passes of uploaded waveforms completed */
+	__u64 passes;
+	/* GPIO_WAVE_CHAIN waveforms that ended with no successor uploaded */
+	__u64 underruns;
+};
+
+#define GPIO_WAVE_IOC_MAGIC 'w'
+/* stop playback, drop the queue and switch engines; resets the stats */
+#define GPIO_WAVE_IOC_ENGINE _IOW(GPIO_WAVE_IOC_MAGIC, 1, __u32)
+/* queue one edge, same as writing it */
+#define GPIO_WAVE_IOC_EDGE _IOW(GPIO_WAVE_IOC_MAGIC, 2, struct gpio_wave_edge)
+#define GPIO_WAVE_IOC_STATS _IOR(GPIO_WAVE_IOC_MAGIC, 3, struct gpio_wave_stats)
+/* stop playback and drop the queue and the uploaded waveforms */
+#define GPIO_WAVE_IOC_STOP _IO(GPIO_WAVE_IOC_MAGIC, 4)
+/* upload a waveform into the free buffer */
+#define GPIO_WAVE_IOC_LOAD _IOW(GPIO_WAVE_IOC_MAGIC, 5, struct gpio_wave_load)
+
+#endif /* GPIO_WAVE_H */
@@ -0,0 +1,281 @@
+/*
+ * wave-app: compile sample files for /dev/gpio-wave, upload them, and
+ * benchmark the compiler.
+ *
+ *   wave-app compile <slot_us> <pin,pin,...> <samples> <records>
+ *       samples holds one array of samples per pin, back to back, all of
+ *       the same length; records receives struct gpio_wave_edge records
+ *   wave-app load <records> [repeat] [chain]
+ *       upload records with GPIO_WAVE_IOC_LOAD, repeat 0 loops
+ *   wave-app bench <npins> <nslots> [run_len]
+ *       compile random patterns whose levels hold run_len slots on
+ *       average with every transpose kernel this CPU has, check they
+ *       agree and report the throughput in GB/s of samples
+ *
+ * Build: gcc -O2 -o wave-app wave-app.c wave-lib.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "wave-lib.h"
+
+#define WAVE_DEVICE "/dev/gpio-wave"
+
+/* Keep each benchmark run going for at least this long */
+#define BENCH_MIN_NS 200000000ull
+
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static int parse_pins(const char *list, unsigned int *pins) {
+    char *end;
+    int n = 0;
+
+    while(*list && n < WAVE_MAX_PINS) {
+        pins[n++] = strtoul(list, &end, 0);
+        if(end == list) {
+            return -1;
+        }
+        list = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+
+static void *read_file(const char *path, size_t *size) {
+    struct stat st;
+    void *buf;
+    FILE *f = fopen(path, "rb");
+
+    if(!f) {
+        return NULL;
+    }
+    if(fstat(fileno(f), &st) || !(buf = malloc(st.st_size ? st.st_size : 1))) {
+        fclose(f);
+        return NULL;
+    }
+    *size = fread(buf, 1, st.st_size, f);
+    fclose(f);
+    return buf;
+}
+
+
+static int run_compile(uint32_t slot_us, const char *pin_list,
+                       const char *in_path, const char *out_path) {
+    unsigned int pins[WAVE_MAX_PINS];
+    const uint8_t *samples[WAVE_MAX_PINS];
+    struct wave_compiler wc;
+    struct gpio_wave_edge *edges;
+    uint8_t *data;
+    size_t size, nslots;
+    long count;
+    int npins, i;
+    FILE *out;
+
+    npins = parse_pins(pin_list, pins);
+    if(npins <= 0 || wave_compiler_init(&wc, pins, npins, WAVE_ISA_AUTO)) {
+        fprintf(stderr, "Bad pin list %s\n", pin_list);
+        return 1;
+    }
+    data = read_file(in_path, &size);
+    if(!data) {
+        perror(in_path);
+        return 1;
+    }
+    nslots = size / npins;
+    for(i = 0; i < npins; i++) {
+        samples[i] = data + i * nslots;
+    }
+
+    /* one record per slot at worst, plus the hold record */
+    edges = malloc((nslots + 1) * sizeof(*edges));
+    if(!edges) {
+        free(data);
+        return 1;
+    }
+    count = wave_compile(&wc, samples, nslots, slot_us, edges, nslots + 1);
+    free(data);
+    if(count < 0) {
+        fprintf(stderr, "Unable to compile: %s\n", strerror(-count));
+        free(edges);
+        return 1;
+    }
+
+    out = fopen(out_path, "wb");
+    if(!out || fwrite(edges, sizeof(*edges), count, out) != (size_t)count) {
+        perror(out_path);
+        if(out) {
+            fclose(out);
+        }
+        free(edges);
+        return 1;
+    }
+    fclose(out);
+    printf("%zu slots of %d pins (%s): %ld records\n",
+           nslots, npins, wave_isa_names[wc.isa], count);
+    free(edges);
+    return 0;
+}
+
+
+static int run_load(const char *path, unsigned int repeat, int chain) {
+    struct gpio_wave_load ld;
+    size_t size;
+    void *edges = read_file(path, &size);
+    int fd, ret;
+
+    if(!edges) {
+        perror(path);
+        return 1;
+    }
+    fd = open(WAVE_DEVICE, O_RDWR);
+    if(fd < 0) {
+        perror(WAVE_DEVICE);
+        free(edges);
+        return 1;
+    }
+
+    memset(&ld, 0, sizeof(ld));
+    ld.edges = (uintptr_t)edges;
+    ld.count = size / sizeof(struct gpio_wave_edge);
+    ld.repeat = repeat;
+    ld.flags = chain ? GPIO_WAVE_CHAIN : 0;
+    ret = ioctl(fd, GPIO_WAVE_IOC_LOAD, &ld);
+    if(ret) {
+        perror("GPIO_WAVE_IOC_LOAD");
+    }
+    close(fd);
+    free(edges);
+    return ret ? 1 : 0;
+}
+
+
+/* Levels that hold about run_len slots, from a xorshift generator */
+static void bench_fill(uint8_t *buf, size_t n, unsigned int run_len, uint64_t *seed) {
+    uint8_t level = 0;
+    size_t t;
+
+    for(t = 0; t < n; t++) {
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        if(*seed % run_len == 0) {
+            level = !level;
+        }
+        buf[t] = level ? (uint8_t)(*seed >> 32) | 1 : 0;
+    }
+}
+
+
+static int run_bench(unsigned int npins, size_t nslots, unsigned int run_len) {
+    unsigned int pins[WAVE_MAX_PINS], i;
+    const uint8_t *samples[WAVE_MAX_PINS];
+    struct gpio_wave_edge *edges, *ref = NULL;
+    struct wave_compiler wc;
+    uint32_t *words;
+    uint8_t *data;
+    uint64_t seed = 0x9E3779B97F4A7C15ull, start, elapsed, runs;
+    double bytes = (double)npins * nslots;
+    long count, ref_count = 0;
+    int isa, ret = 0;
+
+    if(npins == 0 || npins > WAVE_MAX_PINS || nslots == 0 || run_len == 0) {
+        return 1;
+    }
+    data = malloc(npins * nslots);
+    edges = malloc((nslots + 1) * sizeof(*edges));
+    ref = malloc((nslots + 1) * sizeof(*ref));
+    words = malloc(2 * nslots * sizeof(*words));
+    if(!data || !edges || !ref || !words) {
+        ret = 1;
+        goto out;
+    }
+    /* spread the pins over both banks */
+    for(i = 0; i < npins; i++) {
+        pins[i] = (i * 7) % WAVE_MAX_PINS;
+        samples[i] = data + i * nslots;
+        bench_fill(data + i * nslots, nslots, run_len, &seed);
+    }
+
+    printf("%u pins, %zu slots, run length %u\n", npins, nslots, run_len);
+    for(isa = WAVE_ISA_SCALAR; isa < WAVE_NR_ISAS; isa++) {
+        if(!wave_isa_supported(isa) || wave_compiler_init(&wc, pins, npins, isa)) {
+            continue;
+        }
+
+        runs = 0;
+        start = monotonic_ns();
+        do {
+            wave_transpose(&wc, samples, 0, nslots, words);
+            runs++;
+        } while((elapsed = monotonic_ns() - start) < BENCH_MIN_NS);
+        printf("  %-6s transpose %6.2f GB/s", wave_isa_names[isa], bytes * runs / elapsed);
+
+        runs = 0;
+        start = monotonic_ns();
+        do {
+            count = wave_compile(&wc, samples, nslots, 1, edges, nslots + 1);
+            runs++;
+        } while((elapsed = monotonic_ns() - start) < BENCH_MIN_NS);
+        printf("  compile %6.2f GB/s  %ld records", bytes * runs / elapsed, count);
+
+        if(isa == WAVE_ISA_SCALAR) {
+            memcpy(ref, edges, count * sizeof(*edges));
+            ref_count = count;
+            printf("\n");
+        }
+        else if(count != ref_count || memcmp(ref, edges, count * sizeof(*edges))) {
+            printf("  MISMATCH\n");
+            ret = 1;
+        }
+        else {
+            printf("  ok\n");
+        }
+    }
+
+out:
+    free(words);
+    free(ref);
+    free(edges);
+    free(data);
+    return ret;
+}
+
+
+int main(int argc, char **argv) {
+    if(argc > 5 && !strcmp(argv[1], "compile")) {
+        return run_compile(strtoul(argv[2], NULL, 0), argv[3], argv[4], argv[5]);
+    }
+    else if(argc > 2 && !strcmp(argv[1], "load")) {
+        unsigned int repeat = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+        int chain = argc > 4 && !strcmp(argv[4], "chain");
+        return run_load(argv[2], repeat, chain);
+    }
+    else if(argc > 3 && !strcmp(argv[1], "bench")) {
+        unsigned int npins = strtoul(argv[2], NULL, 0);
+        size_t nslots = strtoull(argv[3], NULL, 0);
+        unsigned int run_len = argc > 4 ? strtoul(argv[4], NULL, 0) : 64;
+        return run_bench(npins, nslots, run_len);
+    }
+
+    fprintf(stderr,
+            "usage: %s compile <slot_us> <pin,pin,...> <samples> <records>\n"
+            "       %s load <records> [repeat] [chain]\n"
+            "       %s bench <npins> <nslots> [run_len]\n",
+            argv[0], argv[0], argv[0]);
+    return 1;
+}
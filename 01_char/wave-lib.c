@@ -0,0 +1,399 @@
+/*
+ * wave-lib: compiles per-pin sample arrays into gpio-wave edge records,
+ * see wave-lib.h.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WAVE_X86 1
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define WAVE_NEON 1
+#endif
+
+#include "wave-lib.h"
+
+
+const char *wave_isa_names[] = { "auto", "scalar", "sse2", "avx2", "neon" };
+
+/* Slots per pass, so the bank words stay in L1 between the two passes */
+#define WAVE_CHUNK 1024
+
+/* Rows of the pins a group does not have */
+static const uint8_t wave_zeros[WAVE_CHUNK];
+
+/*
+ * A transpose kernel packs rows[j][t] != 0 into bit j of out[t] for as
+ * many whole blocks of t < n as it handles and returns how far it got.
+ */
+typedef size_t (*transpose_fn)(const uint8_t *const rows[16], size_t n, uint16_t *out);
+
+
+static size_t transpose16_scalar(const uint8_t *const rows[16], size_t n, uint16_t *out) {
+    size_t t;
+    int j;
+
+    memset(out, 0, n * sizeof(*out));
+    for(j = 0; j < 16; j++) {
+        const uint8_t *row = rows[j];
+
+        if(row == wave_zeros) {
+            continue;
+        }
+        for(t = 0; t < n; t++) {
+            out[t] |= (uint16_t)((row[t] != 0) << j);
+        }
+    }
+    return n;
+}
+
+
+/*
+ * The SIMD kernels transpose a 16 x 16 byte block with four rounds of
+ * out[2i] = lo(in[i], in[i + 8]), out[2i + 1] = hi(in[i], in[i + 8]).
+ * Each round rotates the 8 bit (row, column) index of every byte left by
+ * one, so after four rows and columns have swapped: row r holds slot r,
+ * byte j of it pin j.
+ */
+#ifdef WAVE_X86
+
+static size_t transpose16_sse2(const uint8_t *const rows[16], size_t n, uint16_t *out) {
+    __m128i a[16], b[16];
+    const __m128i zero = _mm_setzero_si128();
+    size_t t;
+    int i, round;
+
+    for(t = 0; t + 16 <= n; t += 16) {
+        for(i = 0; i < 16; i++) {
+            a[i] = _mm_loadu_si128((const __m128i *)(rows[i] + t));
+        }
+        for(round = 0; round < 2; round++) {
+            for(i = 0; i < 8; i++) {
+                b[2 * i] = _mm_unpacklo_epi8(a[i], a[i + 8]);
+                b[2 * i + 1] = _mm_unpackhi_epi8(a[i], a[i + 8]);
+            }
+            for(i = 0; i < 8; i++) {
+                a[2 * i] = _mm_unpacklo_epi8(b[i], b[i + 8]);
+                a[2 * i + 1] = _mm_unpackhi_epi8(b[i], b[i + 8]);
+            }
+        }
+        for(i = 0; i < 16; i++) {
+            out[t + i] = (uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(a[i], zero));
+        }
+    }
+    return t;
+}
+
+
+/* unpack stays within 128 bit lanes: two blocks, slots t..t+15 and t+16..t+31 */
+__attribute__((target("avx2")))
+static size_t transpose16_avx2(const uint8_t *const rows[16], size_t n, uint16_t *out) {
+    __m256i a[16], b[16];
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t bits;
+    size_t t;
+    int i, round;
+
+    for(t = 0; t + 32 <= n; t += 32) {
+        for(i = 0; i < 16; i++) {
+            a[i] = _mm256_loadu_si256((const __m256i *)(rows[i] + t));
+        }
+        for(round = 0; round < 2; round++) {
+            for(i = 0; i < 8; i++) {
+                b[2 * i] = _mm256_unpacklo_epi8(a[i], a[i + 8]);
+                b[2 * i + 1] = _mm256_unpackhi_epi8(a[i], a[i + 8]);
+            }
+            for(i = 0; i < 8; i++) {
+                a[2 * i] = _mm256_unpacklo_epi8(b[i], b[i + 8]);
+                a[2 * i + 1] = _mm256_unpackhi_epi8(b[i], b[i + 8]);
+            }
+        }
+        for(i = 0; i < 16; i++) {
+            bits = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a[i], zero));
+            out[t + i] = (uint16_t)bits;
+            out[t + 16 + i] = (uint16_t)(bits >> 16);
+        }
+    }
+    return t;
+}
+
+#endif /* WAVE_X86 */
+
+
+#ifdef WAVE_NEON
+
+/* NEON has no movemask: weigh the bytes by their bit and add up each half */
+static size_t transpose16_neon(const uint8_t *const rows[16], size_t n, uint16_t *out) {
+    static const uint8_t weights[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    const uint8x16_t w = vld1q_u8(weights);
+    uint8x16_t a[16], b[16], bits;
+    size_t t;
+    int i, round;
+
+    for(t = 0; t + 16 <= n; t += 16) {
+        for(i = 0; i < 16; i++) {
+            a[i] = vld1q_u8(rows[i] + t);
+        }
+        for(round = 0; round < 2; round++) {
+            for(i = 0; i < 8; i++) {
+                b[2 * i] = vzip1q_u8(a[i], a[i + 8]);
+                b[2 * i + 1] = vzip2q_u8(a[i], a[i + 8]);
+            }
+            for(i = 0; i < 8; i++) {
+                a[2 * i] = vzip1q_u8(b[i], b[i + 8]);
+                a[2 * i + 1] = vzip2q_u8(b[i], b[i + 8]);
+            }
+        }
+        for(i = 0; i < 16; i++) {
+            bits = vandq_u8(vtstq_u8(a[i], a[i]), w);
+            out[t + i] = (uint16_t)(vaddv_u8(vget_low_u8(bits)) |
+                                    (vaddv_u8(vget_high_u8(bits)) << 8));
+        }
+    }
+    return t;
+}
+
+#endif /* WAVE_NEON */
+
+
+int wave_isa_supported(enum wave_isa isa) {
+    switch(isa) {
+    case WAVE_ISA_AUTO:
+    case WAVE_ISA_SCALAR:
+        return 1;
+#ifdef WAVE_X86
+    case WAVE_ISA_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case WAVE_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef WAVE_NEON
+    case WAVE_ISA_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+
+static transpose_fn wave_kernel(enum wave_isa isa) {
+    switch(isa) {
+#ifdef WAVE_X86
+    case WAVE_ISA_SSE2:
+        return transpose16_sse2;
+    case WAVE_ISA_AVX2:
+        return transpose16_avx2;
+#endif
+#ifdef WAVE_NEON
+    case WAVE_ISA_NEON:
+        return transpose16_neon;
+#endif
+    default:
+        return transpose16_scalar;
+    }
+}
+
+
+int wave_compiler_init(struct wave_compiler *wc,
+                       const unsigned int *pins,
+                       unsigned int npins,
+                       enum wave_isa isa) {
+    unsigned int i, lane, val, bit;
+
+    if(npins == 0 || npins > WAVE_MAX_PINS || isa >= WAVE_NR_ISAS) {
+        return -EINVAL;
+    }
+    if(!wave_isa_supported(isa)) {
+        return -ENOTSUP;
+    }
+    if(isa == WAVE_ISA_AUTO) {
+        isa = WAVE_ISA_SCALAR;
+        for(i = WAVE_ISA_SSE2; i < WAVE_NR_ISAS; i++) {
+            if(wave_isa_supported(i)) {
+                isa = i;
+            }
+        }
+    }
+
+    memset(wc, 0, sizeof(*wc));
+    wc->npins = npins;
+    wc->isa = isa;
+    for(i = 0; i < npins; i++) {
+        if(pins[i] >= WAVE_MAX_PINS || (wc->mask[pins[i] / 32] & (1u << (pins[i] % 32)))) {
+            return -EINVAL;
+        }
+        wc->pins[i] = pins[i];
+        wc->mask[pins[i] / 32] |= 1u << (pins[i] % 32);
+    }
+
+    for(lane = 0; lane * 8 < npins; lane++) {
+        for(val = 0; val < 256; val++) {
+            for(bit = 0; bit < 8 && lane * 8 + bit < npins; bit++) {
+                unsigned int pin = pins[lane * 8 + bit];
+
+                if(val & (1u << bit)) {
+                    wc->scatter[lane][val][pin / 32] |= 1u << (pin % 32);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+
+/* wave_transpose() of at most WAVE_CHUNK slots */
+static void wave_transpose_chunk(const struct wave_compiler *wc,
+                                 transpose_fn kernel,
+                                 const uint8_t *const *samples,
+                                 size_t t0,
+                                 size_t n,
+                                 uint32_t *words) {
+    const uint8_t *rows[16];
+    uint16_t packed[WAVE_CHUNK];
+    unsigned int group, j, pin;
+    size_t t, done;
+
+    memset(words, 0, 2 * n * sizeof(*words));
+    for(group = 0; group * 16 < wc->npins; group++) {
+        const uint32_t (*lo)[2] = wc->scatter[2 * group];
+        const uint32_t (*hi)[2] = wc->scatter[2 * group + 1];
+
+        for(j = 0; j < 16; j++) {
+            pin = group * 16 + j;
+            rows[j] = pin < wc->npins ? samples[pin] + t0 : wave_zeros;
+        }
+        done = kernel(rows, n, packed);
+        if(done < n) {
+            for(j = 0; j < 16; j++) {
+                if(rows[j] != wave_zeros) {
+                    rows[j] += done;
+                }
+            }
+            transpose16_scalar(rows, n - done, packed + done);
+        }
+
+        for(t = 0; t < n; t++) {
+            words[2 * t] |= lo[packed[t] & 0xFF][0] | hi[packed[t] >> 8][0];
+            words[2 * t + 1] |= lo[packed[t] & 0xFF][1] | hi[packed[t] >> 8][1];
+        }
+    }
+}
+
+
+void wave_transpose(const struct wave_compiler *wc,
+                    const uint8_t *const *samples,
+                    size_t t0,
+                    size_t n,
+                    uint32_t *words) {
+    transpose_fn kernel = wave_kernel(wc->isa);
+    size_t len;
+
+    while(n) {
+        len = n < WAVE_CHUNK ? n : WAVE_CHUNK;
+        wave_transpose_chunk(wc, kernel, samples, t0, len, words);
+        t0 += len;
+        n -= len;
+        words += 2 * len;
+    }
+}
+
+
+/* Compile state carried from chunk to chunk */
+struct wave_out {
+    struct gpio_wave_edge *edges;
+    size_t count;
+    size_t max;
+    uint32_t slot_us;
+    /* slot of the last record, and the levels it left */
+    size_t last;
+    uint32_t prev[2];
+};
+
+/* Record at slot t; gaps beyond the 32 bit delta get empty records */
+static int wave_emit(struct wave_out *o, size_t t,
+                     uint32_t set0, uint32_t set1,
+                     uint32_t clr0, uint32_t clr1) {
+    uint64_t delta = (uint64_t)(t - o->last) * o->slot_us;
+    struct gpio_wave_edge *e;
+
+    for(;;) {
+        if(o->count == o->max) {
+            return -ENOSPC;
+        }
+        e = &o->edges[o->count++];
+        if(delta <= UINT32_MAX) {
+            break;
+        }
+        memset(e, 0, sizeof(*e));
+        e->delta_us = UINT32_MAX;
+        delta -= UINT32_MAX;
+    }
+    e->delta_us = (uint32_t)delta;
+    e->set[0] = set0;
+    e->set[1] = set1;
+    e->clr[0] = clr0;
+    e->clr[1] = clr1;
+    o->last = t;
+    return 0;
+}
+
+
+long wave_compile(const struct wave_compiler *wc,
+                  const uint8_t *const *samples,
+                  size_t nslots,
+                  uint32_t slot_us,
+                  struct gpio_wave_edge *out,
+                  size_t max_out) {
+    transpose_fn kernel = wave_kernel(wc->isa);
+    uint32_t words[2 * WAVE_CHUNK], w0, w1, d0, d1;
+    struct wave_out o = { out, 0, max_out, slot_us, 0, { 0, 0 } };
+    size_t t0, t, len;
+
+    if(nslots == 0) {
+        return 0;
+    }
+
+    for(t0 = 0; t0 < nslots; t0 += len) {
+        len = nslots - t0 < WAVE_CHUNK ? nslots - t0 : WAVE_CHUNK;
+        wave_transpose_chunk(wc, kernel, samples, t0, len, words);
+
+        t = 0;
+        if(t0 == 0) {
+            /* whatever the pins were before (or at the end of the previous pass) */
+            if(wave_emit(&o, 0, words[0], words[1],
+                         wc->mask[0] & ~words[0], wc->mask[1] & ~words[1])) {
+                return -ENOSPC;
+            }
+            o.prev[0] = words[0];
+            o.prev[1] = words[1];
+            t = 1;
+        }
+        for(; t < len; t++) {
+            w0 = words[2 * t];
+            w1 = words[2 * t + 1];
+            d0 = w0 ^ o.prev[0];
+            d1 = w1 ^ o.prev[1];
+            if(!(d0 | d1)) {
+                continue;
+            }
+            if(wave_emit(&o, t0 + t, d0 & w0, d1 & w1, d0 & ~w0, d1 & ~w1)) {
+                return -ENOSPC;
+            }
+            o.prev[0] = w0;
+            o.prev[1] = w1;
+        }
+    }
+
+    /* hold the last levels until the end of the final slot */
+    if(wave_emit(&o, nslots, 0, 0, 0, 0)) {
+        return -ENOSPC;
+    }
+    return (long)o.count;
+}
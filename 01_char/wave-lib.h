@@ -0,0 +1,92 @@
+/*
+ * wave-lib: compiles per-pin sample arrays into gpio-wave edge records.
+ *
+ * Test patterns come as one byte array per pin, one sample per time
+ * slot, nonzero meaning high.  wave_compile() turns them into the
+ * struct gpio_wave_edge records /dev/gpio-wave plays, in two passes over
+ * cache sized chunks:
+ *
+ *   - transpose: 16 pins x 16 (SSE2, NEON) or 32 (AVX2) slots at a time
+ *     are byte-transposed with four rounds of unpack/zip, and one
+ *     movemask per slot packs the 16 pins into bits; a scatter table
+ *     then moves those bits to the pins' places in the GPIO bank words
+ *   - diff: consecutive bank words are XORed into set and clear masks,
+ *     and slots without a change only add to the next record's delta
+ *
+ * The first record drives every pin explicitly and a last record with
+ * empty masks holds until the end of the final slot, so a compiled
+ * waveform is nslots * slot_us long and can be looped.
+ *
+ * Build: gcc -O2 -o wave-app wave-app.c wave-lib.c
+ */
+#ifndef WAVE_LIB_H
+#define WAVE_LIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gpio-wave.h"
+
+
+#define WAVE_MAX_PINS 54
+/* 16 pin groups of the transpose kernels, two scatter lanes each */
+#define WAVE_GROUPS ((WAVE_MAX_PINS + 15) / 16)
+#define WAVE_LANES (WAVE_GROUPS * 2)
+
+/* Which transpose kernel to use; AUTO picks the widest one available */
+enum wave_isa {
+    WAVE_ISA_AUTO,
+    WAVE_ISA_SCALAR,
+    WAVE_ISA_SSE2,
+    WAVE_ISA_AVX2,
+    WAVE_ISA_NEON,
+    WAVE_NR_ISAS
+};
+
+extern const char *wave_isa_names[];
+
+struct wave_compiler {
+    unsigned int npins;
+    unsigned char pins[WAVE_MAX_PINS];
+    /* all pins, per bank */
+    uint32_t mask[2];
+    /* scatter[lane][byte of the packed pin bits][bank] */
+    uint32_t scatter[WAVE_LANES][256][2];
+    enum wave_isa isa;
+};
+
+/* Nonzero if this build and CPU can run [isa] */
+int wave_isa_supported(enum wave_isa isa);
+
+/*
+ * samples[i] of wave_compile() will drive GPIO pins[i].  Returns 0, or
+ * -EINVAL for a bad or repeated pin and -ENOTSUP for an ISA this CPU
+ * lacks.
+ */
+int wave_compiler_init(struct wave_compiler *wc,
+                       const unsigned int *pins,
+                       unsigned int npins,
+                       enum wave_isa isa);
+
+/*
+ * Bank words of slots [t0, t0 + n): words[2 * t] and words[2 * t + 1]
+ * are GPLEV0/GPLEV1 as the pins would read in slot t0 + t.
+ */
+void wave_transpose(const struct wave_compiler *wc,
+                    const uint8_t *const *samples,
+                    size_t t0,
+                    size_t n,
+                    uint32_t *words);
+
+/*
+ * Compile nslots slots of slot_us each into at most max_out records.
+ * Returns the number of records, or -ENOSPC if they do not fit.
+ */
+long wave_compile(const struct wave_compiler *wc,
+                  const uint8_t *const *samples,
+                  size_t nslots,
+                  uint32_t slot_us,
+                  struct gpio_wave_edge *out,
+                  size_t max_out);
+
+#endif /* WAVE_LIB_H */
@@ -42,106 +42,1301 @@ All rights reserved.
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "i2c-lib.h"
 
 
 #define I2C_FILE_NAME "/dev/i2c-0"
 #define USAGE_MESSAGE \
     "Usage:\n" \
-    "  %s r [addr] [register]   " \
+    "  %1$s [options] r [addr] [register]   " \
         "to read value from [register]\n" \
-    "  %s w [addr] [register] [value]   " \
+    "  %1$s [options] w [addr] [register] [value]   " \
         "to write a value [value] to register [register]\n" \
+    "  %1$s [options] bench [addr] [register] [count] [mix] [len]   " \
+        "to time [count] transactions and print JSON statistics\n" \
+    "      [mix] is a pattern repeated over the run, one letter per\n" \
+    "      transaction: s = byte read, w = byte write, d = word read,\n" \
+    "      b = [len] byte block read, k = SMBus block read,\n" \
+    "      m = [len] byte reads batched in one I2C_RDWR\n" \
+    "  %1$s [options] sample [addr] [registers] [rate] [count] [file] [csv]   " \
+        "to log [count] samples (0 = until ^C) of [registers], e.g.\n" \
+    "      0x10-0x17,0x20, at [rate] Hz to [file] (- = stdout) as binary\n" \
+    "      records, or as text when [csv] is given\n" \
+    "  %1$s [options] dump [addr] [register] [count] [file]   " \
+        "to save [count] registers from [register] to [file]\n" \
+    "  %1$s [options] restore [addr] [file]   " \
+        "to write back the registers in [file] that changed\n" \
+    "  %1$s [options] program [addr] [file] [page] [addr bytes] [offset]   " \
+        "to write [file] to a 24Cxx EEPROM with\n" \
+    "      [page] byte page writes and verify it, using a 1 or 2 byte\n" \
+    "      word address (default 16, 1, 0)\n" \
+    "  %1$s [options] async [addr] [register] [threads] [count] [len]   " \
+        "to compare [threads] callers doing [count]\n" \
+    "      [len] byte reads each, serialized vs. through the batching worker\n" \
+    "  %1$s [options] scan [bus...]   " \
+        "to list responding addresses on each [bus] (N or\n" \
+    "      /dev/i2c-N) in parallel, or on the default device\n" \
+    "Options:\n" \
+    "  -d [device]   i2c-dev node to use (default " I2C_FILE_NAME ")\n" \
+    "  -p auto|smbus|rdwr   transfer primitive; auto picks SMBus when\n" \
+    "      the adapter supports it and falls back to I2C_RDWR;\n" \
+    "      smbus fails what the adapter cannot do as SMBus\n" \
+    "  -r [retries]   retries for lost arbitration and timeouts (default 2)\n" \
+    "  -s [file]   collect per-address transaction statistics and write\n" \
+    "      them as JSON to [file] (- = stderr) on exit and on SIGUSR1\n" \
     ""
 
-static int set_i2c_register(int file,
-                            unsigned char addr,
-                            unsigned char reg,
-                            unsigned char value) {
+/* Default block length for the benchmark's 'b' and 'm' transactions */
+#define BENCH_DEFAULT_LEN 16
+
+/* Registers per batched read, limited by I2C_RDWR_IOCTL_MAX_MSGS */
+#define BENCH_MAX_BATCH I2C_MAX_BATCH
+
+enum bench_op {
+    BENCH_SINGLE,
+    BENCH_WRITE,
+    BENCH_BLOCK,
+    BENCH_BATCH,
+    BENCH_WORD,
+    BENCH_SMBUS_BLOCK,
+    BENCH_NR_OPS
+};
 
-    unsigned char outbuf[2];
-    struct i2c_rdwr_ioctl_data packets;
-    struct i2c_msg messages[1];
+static const char *bench_op_names[BENCH_NR_OPS] = {
+    "single", "write", "block", "batch", "word", "smbus_block"
+};
 
-    messages[0].addr  = addr;
-    messages[0].flags = 0;
-    messages[0].len   = sizeof(outbuf);
-    messages[0].buf   = outbuf;
+struct bench_stats {
+    struct lat_hist hist;
+    unsigned long long errors;
+    unsigned long long bytes;
+};
+
+
+static void print_op_json(const char *name, const struct bench_stats *st) {
+    printf("\"%s\":{\"count\":%llu,\"errors\":%llu,\"bytes\":%llu,"
+           "\"min_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+           "\"p999_ns\":%llu,\"max_ns\":%llu}",
+           name, st->hist.total, st->errors, st->bytes,
+           (unsigned long long)st->hist.min_ns,
+           (unsigned long long)hist_quantile(&st->hist, 0.50),
+           (unsigned long long)hist_quantile(&st->hist, 0.99),
+           (unsigned long long)hist_quantile(&st->hist, 0.999),
+           (unsigned long long)st->hist.max_ns);
+}
 
-    /* The first byte indicates which register we'll write */
-    outbuf[0] = reg;
 
-    /* 
-     * The second byte indicates the value to write.  Note that for many
-     * devices, we can write multiple, sequential registers at once by
-     * simply making outbuf bigger.
-     */
-    outbuf[1] = value;
+/*
+ * Issue [count] transactions following the [mix] pattern and print one
+ * JSON object with per-operation latency percentiles and overall rates.
+ * Failed transactions are timed and counted but not included in bytes.
+ */
+static int run_bench(struct i2c_bus *bus,
+                     const char *device,
+                     unsigned char addr,
+                     unsigned char reg,
+                     long count,
+                     const char *mix,
+                     int len) {
+    static struct bench_stats stats[BENCH_NR_OPS];
+    unsigned char regs[BENCH_MAX_BATCH];
+    unsigned char buf[256];
+    unsigned long long total_bytes = 0, total_ok = 0;
+    size_t mix_len = strlen(mix);
+    uint64_t start, elapsed;
+    double seconds;
+    long i;
+    int op, first = 1;
 
-    /* Transfer the i2c packets to the kernel and verify it worked */
-    packets.msgs  = messages;
-    packets.nmsgs = 1;
-    if(ioctl(file, I2C_RDWR, &packets) < 0) {
-        perror("Unable to send data");
+    if(mix_len == 0 || len <= 0 || len > (int)sizeof(buf)) {
+        fprintf(stderr, "Invalid mix or length\n");
+        return 1;
+    }
+    if(strchr(mix, 'm') && len > BENCH_MAX_BATCH) {
+        fprintf(stderr, "Batched reads are limited to %d registers\n",
+                BENCH_MAX_BATCH);
         return 1;
     }
+    for(i = 0; i < (long)mix_len; i++) {
+        if(!strchr("swbmdk", mix[i])) {
+            fprintf(stderr, "Unknown transaction '%c' in mix\n", mix[i]);
+            return 1;
+        }
+    }
+    for(i = 0; i < BENCH_MAX_BATCH; i++) {
+        regs[i] = reg + i;
+    }
+
+    start = monotonic_ns();
+    for(i = 0; i < count; i++) {
+        uint64_t t0, t1;
+        int ret, bytes;
+
+        t0 = monotonic_ns();
+        switch(mix[i % mix_len]) {
+        case 's':
+            op = BENCH_SINGLE;
+            bytes = 1;
+            ret = i2c_read_byte(bus, addr, reg, buf);
+            break;
+        case 'w':
+            op = BENCH_WRITE;
+            bytes = 1;
+            ret = i2c_write_byte(bus, addr, reg, (unsigned char)i);
+            break;
+        case 'b':
+            op = BENCH_BLOCK;
+            bytes = len;
+            ret = i2c_read_block(bus, addr, reg, buf, len);
+            break;
+        case 'd': {
+            unsigned short word;
+
+            op = BENCH_WORD;
+            bytes = 2;
+            ret = i2c_read_word(bus, addr, reg, &word);
+            break;
+        }
+        case 'k':
+            op = BENCH_SMBUS_BLOCK;
+            ret = bytes = i2c_read_smbus_block(bus, addr, reg, buf);
+            break;
+        default:
+            op = BENCH_BATCH;
+            bytes = len;
+            ret = get_i2c_register_batch(bus, addr, regs, buf, len);
+            break;
+        }
+        t1 = monotonic_ns();
+
+        hist_add(&stats[op].hist, t1 - t0);
+        if(ret < 0) {
+            stats[op].errors++;
+        }
+        else {
+            stats[op].bytes += bytes;
+            total_bytes += bytes;
+            total_ok++;
+        }
+    }
+    elapsed = monotonic_ns() - start;
+    seconds = elapsed ? elapsed / 1e9 : 1e-9;
+
+    printf("{\"device\":\"%s\",\"path\":\"%s\",\"funcs\":%lu,"
+           "\"addr\":%d,\"register\":%d,"
+           "\"mix\":\"%s\",\"len\":%d,\"transactions\":%ld,"
+           "\"completed\":%llu,\"elapsed_ns\":%llu,"
+           "\"transactions_per_s\":%.1f,\"bytes_per_s\":%.1f,\"ops\":{",
+           device, i2c_path_names[bus->path], bus->funcs,
+           addr, reg, mix, len, count, total_ok,
+           (unsigned long long)elapsed,
+           total_ok / seconds, total_bytes / seconds);
+    for(op = 0; op < BENCH_NR_OPS; op++) {
+        if(stats[op].hist.total == 0) {
+            continue;
+        }
+        if(!first) {
+            printf(",");
+        }
+        print_op_json(bench_op_names[op], &stats[op]);
+        first = 0;
+    }
+    printf("}}\n");
 
     return 0;
 }
 
 
-static int get_i2c_register(int file,
-                            unsigned char addr,
-                            unsigned char reg,
-                            unsigned char *val) {
-    unsigned char inbuf, outbuf;
-    struct i2c_rdwr_ioctl_data packets;
-    struct i2c_msg messages[2];
+/*
+ * Sampling log format.  The binary log starts with a fixed header and the
+ * list of sampled registers, then one record per sample: a 64-bit
+ * CLOCK_MONOTONIC timestamp (ns) followed by one byte per register in the
+ * order of the list.  Multi-byte fields are in host byte order.
+ */
+#define SAMPLE_MAGIC "I2CS"
+#define SAMPLE_VERSION 1
+#define SAMPLE_MAX_REGS 256
+/* Give up after this many failed samples in a row */
+#define SAMPLE_MAX_ERRORS 100
+
+struct sample_header {
+    char magic[4];
+    uint16_t version;
+    uint8_t addr;
+    uint8_t reserved;
+    uint32_t nregs;
+    uint64_t period_ns;
+    /* followed by nregs register numbers, one byte each */
+} __attribute__((packed));
+
+/* A run of consecutive registers that is fetched with one block read */
+struct sample_run {
+    unsigned char reg;
+    unsigned short len;
+    unsigned short offset;
+};
+
+static volatile sig_atomic_t sample_stop;
+
+
+static void sample_sigint(int sig) {
+    (void)sig;
+    sample_stop = 1;
+}
 
-    /*
-     * In order to read a register, we first do a "dummy write" by writing
-     * 0 bytes to the register we want to read from.  This is similar to
-     * the packet in set_i2c_register, except it's 1 byte rather than 2.
-     */
-    outbuf = reg;
-    messages[0].addr  = addr;
-    messages[0].flags = 0;
-    messages[0].len   = sizeof(outbuf);
-    messages[0].buf   = &outbuf;
 
-    /* The data will get returned in this structure */
-    messages[1].addr  = addr;
-    messages[1].flags = I2C_M_RD/* | I2C_M_NOSTART*/;
-    messages[1].len   = sizeof(inbuf);
-    messages[1].buf   = &inbuf;
+/*
+ * Parse a register set like "0x10-0x17,0x20" into [regs], preserving the
+ * given order.  Returns the number of registers or -1.
+ */
+static int parse_register_set(const char *spec, unsigned char *regs) {
+    int n = 0;
+
+    while(*spec) {
+        char *end;
+        long first = strtol(spec, &end, 0), last = first;
+
+        if(end == spec) {
+            return -1;
+        }
+        if(*end == '-') {
+            spec = end + 1;
+            last = strtol(spec, &end, 0);
+            if(end == spec) {
+                return -1;
+            }
+        }
+        if(first < 0 || last > 0xff || last < first ||
+           n + (last - first + 1) > SAMPLE_MAX_REGS) {
+            return -1;
+        }
+        while(first <= last) {
+            regs[n++] = first++;
+        }
+        if(*end == ',') {
+            end++;
+        }
+        else if(*end) {
+            return -1;
+        }
+        spec = end;
+    }
 
-    /* Send the request to the kernel and get the result back */
-    packets.msgs      = messages;
-    packets.nmsgs     = 2;
-    if(ioctl(file, I2C_RDWR, &packets) < 0) {
-        perror("Unable to send data");
+    return n;
+}
+
+
+/*
+ * Collapse consecutive register numbers so each run is one transaction,
+ * splitting runs at [limit] registers like the dump does
+ */
+static int build_sample_runs(const unsigned char *regs, int nregs,
+                             unsigned short limit,
+                             struct sample_run *runs) {
+    int i, nruns = 0;
+
+    for(i = 0; i < nregs; i++) {
+        if(nruns && runs[nruns - 1].len < limit &&
+           runs[nruns - 1].reg + runs[nruns - 1].len == regs[i]) {
+            runs[nruns - 1].len++;
+            continue;
+        }
+        runs[nruns].reg    = regs[i];
+        runs[nruns].len    = 1;
+        runs[nruns].offset = i;
+        nruns++;
+    }
+
+    return nruns;
+}
+
+
+/*
+ * Read [regs] from [addr] every 1/[rate] seconds until [count] deadlines
+ * passed (0 = until SIGINT); a failed read uses up its deadline without
+ * logging, and SAMPLE_MAX_ERRORS of them in a row end the run, as the
+ * device is gone.  Deadlines come from a timerfd armed on
+ * the absolute CLOCK_MONOTONIC grid, so a slow transfer delays one sample
+ * but never shifts the ones after it; the timerfd expiration count tells
+ * us how many deadlines were skipped.
+ */
+static int run_sample(struct i2c_bus *bus,
+                      unsigned char addr,
+                      const char *reg_spec,
+                      double rate,
+                      long count,
+                      const char *path,
+                      int csv) {
+    unsigned char regs[SAMPLE_MAX_REGS], values[SAMPLE_MAX_REGS];
+    struct sample_run runs[SAMPLE_MAX_REGS];
+    struct itimerspec its;
+    struct timespec now;
+    unsigned long long taken = 0, missed = 0, errors = 0, failing = 0;
+    uint64_t period_ns, start, elapsed;
+    FILE *out;
+    int tfd, nregs, nruns, i, ret = 0;
+
+    if((nregs = parse_register_set(reg_spec, regs)) <= 0) {
+        fprintf(stderr, "Invalid register set '%s'\n", reg_spec);
         return 1;
     }
-    *val = inbuf;
+    if(rate <= 0 || rate > 1e6) {
+        fprintf(stderr, "Invalid sample rate\n");
+        return 1;
+    }
+    nruns = build_sample_runs(regs, nregs,
+                              i2c_block_limit(bus, I2C_FUNC_SMBUS_READ_I2C_BLOCK),
+                              runs);
+    period_ns = (uint64_t)(1e9 / rate);
 
+    out = strcmp(path, "-") ? fopen(path, csv ? "w" : "wb") : stdout;
+    if(!out) {
+        perror("Unable to open sample log");
+        return 1;
+    }
+    /* Samples are small; let stdio batch them into large writes */
+    setvbuf(out, NULL, _IOFBF, 1 << 16);
+
+    if(csv) {
+        fprintf(out, "timestamp_ns");
+        for(i = 0; i < nregs; i++) {
+            fprintf(out, ",reg_0x%02x", regs[i]);
+        }
+        fprintf(out, "\n");
+    }
+    else {
+        struct sample_header hdr;
+
+        memcpy(hdr.magic, SAMPLE_MAGIC, sizeof(hdr.magic));
+        hdr.version   = SAMPLE_VERSION;
+        hdr.addr      = addr;
+        hdr.reserved  = 0;
+        hdr.nregs     = nregs;
+        hdr.period_ns = period_ns;
+        fwrite(&hdr, sizeof(hdr), 1, out);
+        fwrite(regs, 1, nregs, out);
+    }
+
+    if((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+        perror("Unable to create timer");
+        if(out != stdout) {
+            fclose(out);
+        }
+        return 1;
+    }
+
+    /* First deadline one period from now, then every period after that */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    its.it_interval.tv_sec  = period_ns / 1000000000ull;
+    its.it_interval.tv_nsec = period_ns % 1000000000ull;
+    its.it_value.tv_sec     = now.tv_sec + its.it_interval.tv_sec;
+    its.it_value.tv_nsec    = now.tv_nsec + its.it_interval.tv_nsec;
+    if(its.it_value.tv_nsec >= 1000000000L) {
+        its.it_value.tv_sec++;
+        its.it_value.tv_nsec -= 1000000000L;
+    }
+    if(timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("Unable to arm timer");
+        close(tfd);
+        if(out != stdout) {
+            fclose(out);
+        }
+        return 1;
+    }
+
+    signal(SIGINT, sample_sigint);
+    start = monotonic_ns();
+    while(!sample_stop && (count == 0 || (long)(taken + errors) < count)) {
+        /* At slow rates SIGUSR1 should not wait for the next sample */
+        struct pollfd fds[2] = {
+            { .fd = tfd, .events = POLLIN },
+            { .fd = i2c_stats_signal_fd(), .events = POLLIN },
+        };
+        uint64_t expirations, ts;
+        int failed = 0;
+
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("Unable to wait for timer");
+            ret = 1;
+            break;
+        }
+        if(fds[1].revents & POLLIN) {
+            i2c_stats_poll(bus);
+        }
+        if(!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+        if(read(tfd, &expirations, sizeof(expirations)) !=
+           sizeof(expirations)) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("Unable to wait for timer");
+            ret = 1;
+            break;
+        }
+        missed += expirations - 1;
+
+        ts = monotonic_ns();
+        for(i = 0; i < nruns; i++) {
+            if(i2c_read_block(bus, addr, runs[i].reg,
+                              &values[runs[i].offset], runs[i].len) < 0) {
+                failed = 1;
+                break;
+            }
+        }
+        if(failed) {
+            errors++;
+            if(++failing == SAMPLE_MAX_ERRORS) {
+                fprintf(stderr, "%d reads in a row failed, giving up\n",
+                        SAMPLE_MAX_ERRORS);
+                ret = 1;
+                break;
+            }
+            continue;
+        }
+        failing = 0;
+
+        if(csv) {
+            fprintf(out, "%llu", (unsigned long long)ts);
+            for(i = 0; i < nregs; i++) {
+                fprintf(out, ",%u", values[i]);
+            }
+            fprintf(out, "\n");
+        }
+        else {
+            fwrite(&ts, sizeof(ts), 1, out);
+            fwrite(values, 1, nregs, out);
+        }
+        taken++;
+    }
+    elapsed = monotonic_ns() - start;
+
+    close(tfd);
+    if(out != stdout) {
+        fclose(out);
+    }
+    else {
+        fflush(out);
+    }
+
+    fprintf(stderr, "samples %llu, missed deadlines %llu, errors %llu, "
+            "target %.1f Hz, achieved %.1f Hz\n",
+            taken, missed, errors, rate,
+            elapsed ? taken / (elapsed / 1e9) : 0.0);
+
+    return ret;
+}
+
+
+/*
+ * Register map dump file: a small header followed by [count] register
+ * values starting at [start].
+ */
+#define DUMP_MAGIC "I2CD"
+
+struct dump_header {
+    char magic[4];
+    uint8_t addr;
+    uint8_t start;
+    uint16_t count;
+} __attribute__((packed));
+
+
+static int run_dump(struct i2c_bus *bus,
+                    unsigned char addr,
+                    int start,
+                    int count,
+                    const char *path) {
+    unsigned char map[256];
+    struct dump_header hdr;
+    FILE *out;
+    int ret;
+
+    if(start < 0 || count <= 0 || start + count > 256) {
+        fprintf(stderr, "Invalid register range\n");
+        return 1;
+    }
+    if((ret = i2c_read_range(bus, addr, start, map, count)) < 0) {
+        errno = -ret;
+        perror("Unable to read registers");
+        return 1;
+    }
+
+    if(!(out = fopen(path, "wb"))) {
+        perror("Unable to open dump file");
+        return 1;
+    }
+    memcpy(hdr.magic, DUMP_MAGIC, sizeof(hdr.magic));
+    hdr.addr  = addr;
+    hdr.start = start;
+    hdr.count = count;
+    if(fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+       fwrite(map, 1, count, out) != (size_t)count) {
+        perror("Unable to write dump file");
+        fclose(out);
+        return 1;
+    }
+    fclose(out);
+
+    printf("Dumped %d registers from 0x%02x\n", count, start);
+    return 0;
+}
+
+
+/*
+ * Bring a device back to a dumped state.  The current map is read with
+ * block reads and compared to the dump; only runs of registers that
+ * differ are written, each as one block write (split at the transfer
+ * limit), so an unchanged map costs nothing but the read-back.
+ * Registers that already hold the right value are never rewritten, which
+ * also keeps write-to-clear style registers untouched.
+ */
+static int run_restore(struct i2c_bus *bus, unsigned char addr, const char *path) {
+    unsigned char want[256], have[256];
+    unsigned short chunk = i2c_block_limit(bus, I2C_FUNC_SMBUS_WRITE_I2C_BLOCK);
+    struct dump_header hdr;
+    int i, ret, writes = 0, bytes = 0;
+    FILE *in;
+
+    if(!(in = fopen(path, "rb"))) {
+        perror("Unable to open dump file");
+        return 1;
+    }
+    if(fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+       memcmp(hdr.magic, DUMP_MAGIC, sizeof(hdr.magic)) ||
+       hdr.count == 0 || hdr.start + hdr.count > 256 ||
+       fread(want, 1, hdr.count, in) != hdr.count) {
+        fprintf(stderr, "Invalid dump file '%s'\n", path);
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+
+    if(hdr.addr != addr) {
+        fprintf(stderr, "Note: dump was taken from 0x%02x\n", hdr.addr);
+    }
+    if((ret = i2c_read_range(bus, addr, hdr.start, have, hdr.count)) < 0) {
+        errno = -ret;
+        perror("Unable to read registers");
+        return 1;
+    }
+
+    for(i = 0; i < hdr.count; ) {
+        int run;
+
+        if(want[i] == have[i]) {
+            i++;
+            continue;
+        }
+        for(run = 1; i + run < hdr.count && run < chunk &&
+            want[i + run] != have[i + run]; run++)
+            ;
+        ret = i2c_write_block(bus, addr, hdr.start + i, &want[i], run);
+        if(ret < 0) {
+            errno = -ret;
+            perror("Unable to write registers");
+            return 1;
+        }
+        writes++;
+        bytes += run;
+        i += run;
+    }
+
+    printf("Restored %d registers from 0x%02x: %d changed, "
+           "%d block writes\n", hdr.count, hdr.start, bytes, writes);
     return 0;
 }
 
 
+/*
+ * EEPROM programming.  24Cxx parts take a page of data per write cycle and
+ * NACK their address until the internal write completes, so instead of
+ * sleeping the worst-case tWR we poll for that ACK.  Parts up to 24C16
+ * have a 1-byte word address and select 256-byte blocks through the low
+ * bits of the slave address; larger parts take a 2-byte word address.
+ */
+#define EEPROM_POLL_TIMEOUT_NS 50000000ull
+#define EEPROM_MAX_PAGE 128
+#define EEPROM_MAX_SIZE 65536
+#define EEPROM_READ_CHUNK 4096
+
+
+/* Slave address and word address bytes for [offset] */
+static unsigned char eeprom_slave(unsigned char addr, int addr_bytes,
+                                  unsigned int offset) {
+    return addr_bytes == 1 ? addr | ((offset >> 8) & 0x07) : addr;
+}
+
+
+/*
+ * Poll until the device ACKs its address again.  An SMBus quick write is
+ * the cheapest probe; without it, re-send the word address pointer, which
+ * every 24Cxx accepts and which the next page write overwrites anyway,
+ * as an SMBus send byte or a one byte I2C_RDWR write.
+ */
+static int eeprom_wait_ready(struct i2c_bus *bus,
+                             unsigned char addr,
+                             unsigned int *polls) {
+    uint64_t deadline = monotonic_ns() + EEPROM_POLL_TIMEOUT_NS;
+    int ret;
+
+    if(!i2c_use_smbus(bus, I2C_FUNC_SMBUS_QUICK) &&
+       !i2c_use_smbus(bus, I2C_FUNC_SMBUS_WRITE_BYTE) && !i2c_use_rdwr(bus)) {
+        return -EOPNOTSUPP;
+    }
+
+    do {
+        (*polls)++;
+        if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_QUICK)) {
+            ret = i2c_smbus_access(bus, addr, I2C_SMBUS_WRITE, 0,
+                               I2C_SMBUS_QUICK, NULL);
+        }
+        else if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_WRITE_BYTE)) {
+            ret = i2c_smbus_access(bus, addr, I2C_SMBUS_WRITE, 0,
+                                   I2C_SMBUS_BYTE, NULL);
+        }
+        else {
+            unsigned char zero = 0;
+            struct i2c_msg msg = { addr, 0, 1, &zero };
+
+            ret = i2c_transfer(bus, &msg, 1);
+        }
+        if(ret == 0) {
+            return 0;
+        }
+    } while(monotonic_ns() < deadline);
+
+    return ret;
+}
+
+
+/* Read [len] bytes at [offset] back from the EEPROM */
+static int eeprom_read(struct i2c_bus *bus,
+                       unsigned char addr,
+                       int addr_bytes,
+                       unsigned int offset,
+                       unsigned char *buf,
+                       unsigned int len) {
+    unsigned int done = 0;
+    int ret;
+
+    while(done < len) {
+        unsigned int pos = offset + done;
+        unsigned int chunk = len - done;
+
+        if(addr_bytes == 1) {
+            /* Sequential reads stay inside one 256-byte block */
+            if(chunk > 256 - (pos & 0xff)) {
+                chunk = 256 - (pos & 0xff);
+            }
+            ret = i2c_read_range(bus, eeprom_slave(addr, 1, pos),
+                                 pos & 0xff, buf + done, chunk);
+        }
+        else if(!i2c_use_rdwr(bus)) {
+            /*
+             * SMBus has no two byte command: a write byte data of the
+             * address with no data sets the pointer, then current address
+             * reads follow it one byte at a time
+             */
+            union i2c_smbus_data data;
+            unsigned int i;
+
+            if(!i2c_use_smbus(bus, I2C_FUNC_SMBUS_WRITE_BYTE_DATA |
+                                   I2C_FUNC_SMBUS_READ_BYTE)) {
+                return -EOPNOTSUPP;
+            }
+            if(chunk > EEPROM_READ_CHUNK) {
+                chunk = EEPROM_READ_CHUNK;
+            }
+            ret = i2c_write_byte(bus, addr, pos >> 8, pos & 0xff);
+            for(i = 0; ret >= 0 && i < chunk; i++) {
+                ret = i2c_smbus_access(bus, addr, I2C_SMBUS_READ, 0,
+                                       I2C_SMBUS_BYTE, &data);
+                buf[done + i] = data.byte;
+            }
+        }
+        else {
+            unsigned char outbuf[2] = { pos >> 8, pos & 0xff };
+            struct i2c_msg messages[2];
+
+            if(chunk > EEPROM_READ_CHUNK) {
+                chunk = EEPROM_READ_CHUNK;
+            }
+            messages[0].addr  = addr;
+            messages[0].flags = 0;
+            messages[0].len   = sizeof(outbuf);
+            messages[0].buf   = outbuf;
+            messages[1].addr  = addr;
+            messages[1].flags = I2C_M_RD;
+            messages[1].len   = chunk;
+            messages[1].buf   = buf + done;
+            ret = i2c_transfer(bus, messages, 2);
+        }
+        if(ret < 0) {
+            return ret;
+        }
+        done += chunk;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Stream [path] into the EEPROM at [offset] through the already open bus:
+ * page-aligned writes, ACK polling between them, then one read-back pass
+ * compared against the image.  The read-back is split wherever the bus
+ * or the device needs it: 32-byte blocks on SMBus, 256-byte blocks on
+ * small EEPROMs, EEPROM_READ_CHUNK otherwise.  Two byte addresses on an
+ * SMBus-only path are read back a byte at a time.
+ */
+static int run_program(struct i2c_bus *bus,
+                       unsigned char addr,
+                       const char *path,
+                       int page,
+                       int addr_bytes,
+                       unsigned int offset) {
+    /* One byte more than any EEPROM holds, to catch oversized images */
+    static unsigned char image[EEPROM_MAX_SIZE + 1], check[EEPROM_MAX_SIZE];
+    unsigned char outbuf[EEPROM_MAX_PAGE + 2];
+    unsigned int size, capacity, done = 0, writes = 0, polls = 0;
+    uint64_t start, elapsed;
+    FILE *in;
+    int ret;
+
+    if(page <= 0 || page > EEPROM_MAX_PAGE || (page & (page - 1)) ||
+       (addr_bytes != 1 && addr_bytes != 2)) {
+        fprintf(stderr, "Invalid page size or address width\n");
+        return 1;
+    }
+    if(!(in = fopen(path, "rb"))) {
+        perror("Unable to open image");
+        return 1;
+    }
+    size = fread(image, 1, sizeof(image), in);
+    if(ferror(in)) {
+        perror("Unable to read image");
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+    capacity = addr_bytes == 1 ? 2048u : 65536u;
+    if(size == 0 || size > capacity || offset > capacity - size) {
+        fprintf(stderr, "Image does not fit the EEPROM\n");
+        return 1;
+    }
+
+    start = monotonic_ns();
+    while(done < size) {
+        unsigned int pos = offset + done;
+        unsigned int len = page - (pos % page);
+        unsigned char slave = eeprom_slave(addr, addr_bytes, pos);
+
+        if(len > size - done) {
+            len = size - done;
+        }
+
+        /*
+         * A 2-byte word address is the high byte as "register" and the
+         * low byte as first data byte; on the wire that is the same as a
+         * plain page write, so the SMBus block path still applies.
+         */
+        if(addr_bytes == 1) {
+            ret = i2c_write_block(bus, slave, pos & 0xff,
+                                  &image[done], len);
+        }
+        else {
+            outbuf[0] = pos & 0xff;
+            memcpy(&outbuf[1], &image[done], len);
+            ret = i2c_write_block(bus, slave, pos >> 8, outbuf, len + 1);
+        }
+        if(ret < 0) {
+            errno = -ret;
+            perror("Unable to write page");
+            return 1;
+        }
+        writes++;
+
+        if((ret = eeprom_wait_ready(bus, slave, &polls)) < 0) {
+            errno = -ret;
+            perror("EEPROM did not finish its write cycle");
+            return 1;
+        }
+        done += len;
+    }
+    elapsed = monotonic_ns() - start;
+
+    if((ret = eeprom_read(bus, addr, addr_bytes, offset, check, size)) < 0) {
+        errno = -ret;
+        perror("Unable to read back image");
+        return 1;
+    }
+    for(done = 0; done < size; done++) {
+        if(check[done] != image[done]) {
+            fprintf(stderr, "Verify failed at 0x%04x: wrote %02x, read %02x\n",
+                    offset + done, image[done], check[done]);
+            return 1;
+        }
+    }
+
+    printf("Programmed %u bytes at 0x%04x: %u page writes, %u ACK polls, "
+           "%.1f ms, verified\n", size, offset, writes, polls, elapsed / 1e6);
+    return 0;
+}
+
+
+/*
+ * Throughput with many concurrent callers.  Every caller thread issues
+ * [count] reads of [len] bytes and waits for each before the next.  The
+ * run is done twice: first with callers taking turns on the bus under a
+ * mutex (what sharing the synchronous helpers amounts to), then through
+ * the asynchronous worker, which coalesces what piles up in its queue.
+ */
+struct async_caller {
+    struct i2c_bus *bus;
+    pthread_mutex_t *bus_lock;
+    struct i2c_async *async;
+    unsigned char addr;
+    unsigned char reg;
+    long count;
+    int len;
+    unsigned long long errors;
+};
+
+
+static void *async_caller_thread(void *arg) {
+    struct async_caller *caller = arg;
+    unsigned char buf[I2C_ASYNC_MAX_LEN];
+    long i;
+
+    for(i = 0; i < caller->count; i++) {
+        int ret;
+
+        if(caller->async) {
+            struct i2c_request req;
+
+            memset(&req, 0, sizeof(req));
+            req.addr = caller->addr;
+            req.reg  = caller->reg;
+            req.buf  = buf;
+            req.len  = caller->len;
+            ret = i2c_async_submit(caller->async, &req);
+            if(ret == 0) {
+                ret = i2c_async_wait(&req);
+            }
+        }
+        else {
+            pthread_mutex_lock(caller->bus_lock);
+            ret = i2c_read_block(caller->bus, caller->addr, caller->reg,
+                                 buf, caller->len);
+            pthread_mutex_unlock(caller->bus_lock);
+        }
+        if(ret < 0) {
+            caller->errors++;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Most caller threads of the async bench */
+#define ASYNC_MAX_THREADS 1024
+
+
+/*
+ * Run all callers once (at most ASYNC_MAX_THREADS); returns elapsed ns
+ * and the summed error count
+ */
+static uint64_t run_async_callers(struct async_caller *callers,
+                                  int threads,
+                                  unsigned long long *errors) {
+    pthread_t tids[ASYNC_MAX_THREADS];
+    uint64_t start;
+    int i;
+
+    *errors = 0;
+    start = monotonic_ns();
+    for(i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, async_caller_thread, &callers[i]);
+    }
+    for(i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        *errors += callers[i].errors;
+    }
+
+    return monotonic_ns() - start;
+}
+
+
+static void print_async_run_json(const char *name,
+                                 uint64_t elapsed,
+                                 unsigned long long requests,
+                                 unsigned long long errors,
+                                 int len) {
+    double seconds = elapsed ? elapsed / 1e9 : 1e-9;
+
+    printf("\"%s\":{\"elapsed_ns\":%llu,\"errors\":%llu,"
+           "\"requests_per_s\":%.1f,\"bytes_per_s\":%.1f",
+           name, (unsigned long long)elapsed, errors,
+           (requests - errors) / seconds,
+           (requests - errors) * (double)len / seconds);
+}
+
+
+static int run_async_bench(struct i2c_bus *bus,
+                           unsigned char addr,
+                           unsigned char reg,
+                           int threads,
+                           long count,
+                           int len) {
+    pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct async_caller *callers;
+    struct i2c_async async;
+    struct i2c_async_stats stats;
+    unsigned long long errors, requests = (unsigned long long)threads * count;
+    uint64_t elapsed;
+    int i, ret;
+
+    if(threads <= 0 || threads > ASYNC_MAX_THREADS || count <= 0 ||
+       len <= 0 || len > I2C_ASYNC_MAX_LEN) {
+        fprintf(stderr, "Invalid thread count, count or length\n");
+        return 1;
+    }
+    if(!(callers = calloc(threads, sizeof(*callers)))) {
+        perror("Unable to allocate callers");
+        return 1;
+    }
+
+    for(i = 0; i < threads; i++) {
+        callers[i].bus      = bus;
+        callers[i].bus_lock = &bus_lock;
+        callers[i].async    = NULL;
+        callers[i].addr     = addr;
+        callers[i].reg      = reg;
+        callers[i].count    = count;
+        callers[i].len      = len;
+        callers[i].errors   = 0;
+    }
+
+    printf("{\"path\":\"%s\",\"threads\":%d,\"requests\":%llu,\"len\":%d,",
+           i2c_path_names[bus->path], threads, requests, len);
+
+    elapsed = run_async_callers(callers, threads, &errors);
+    print_async_run_json("sync", elapsed, requests, errors, len);
+    printf("},");
+
+    if((ret = i2c_async_start(&async, bus)) < 0) {
+        printf("}\n");
+        free(callers);
+        errno = -ret;
+        perror("Unable to start worker");
+        return 1;
+    }
+    for(i = 0; i < threads; i++) {
+        callers[i].async  = &async;
+        callers[i].errors = 0;
+    }
+    elapsed = run_async_callers(callers, threads, &errors);
+    i2c_async_get_stats(&async, &stats);
+    i2c_async_stop(&async);
+
+    print_async_run_json("async", elapsed, requests, errors, len);
+    printf(",\"batches\":%llu,\"avg_batch\":%.2f,\"replays\":%llu}}\n",
+           stats.batches,
+           stats.batches ? (double)stats.batched_requests / stats.batches : 1.0,
+           stats.replays);
+
+    free(callers);
+    return 0;
+}
+
+
+/*
+ * Bus scan.  Addresses 0x03-0x77 are probed the way i2cdetect's default
+ * mode does it: a read byte in the EEPROM and 0x30-0x37 ranges, where a
+ * quick write could latch a write-protect command, and a quick write
+ * everywhere else.  Each probe uses the cheapest primitive the adapter
+ * has: SMBus quick/read byte, or a zero/one byte I2C_RDWR message that
+ * looks the same on the wire.
+ *
+ * Probes can't share one I2C_RDWR call: the kernel aborts a combined
+ * transfer at the first NACK without saying which message failed, and
+ * most addresses NACK.  Buses are independent though, so every bus gets
+ * its own thread.
+ */
+#define SCAN_FIRST 0x03
+#define SCAN_LAST 0x77
+
+enum scan_result {
+    SCAN_NONE,
+    SCAN_FOUND,
+    SCAN_BUSY
+};
+
+struct scan_job {
+    char device[64];
+    struct i2c_bus bus;
+    /* the shared bus from main(), or NULL to open [device] */
+    struct i2c_bus *shared;
+    enum i2c_path_mode path;
+    int max_retries;
+    FILE *stats_out;
+    enum scan_result result[SCAN_LAST + 1];
+    const char *method;
+    uint64_t elapsed;
+    int error;
+};
+
+
+static int scan_use_read(unsigned char addr) {
+    return (addr >= 0x30 && addr <= 0x37) || (addr >= 0x50 && addr <= 0x5f);
+}
+
+
+static enum scan_result scan_probe(struct i2c_bus *bus, unsigned char addr) {
+    int ret;
+
+    if(scan_use_read(addr)) {
+        if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_READ_BYTE)) {
+            union i2c_smbus_data data;
+
+            ret = i2c_smbus_access(bus, addr, I2C_SMBUS_READ, 0,
+                                   I2C_SMBUS_BYTE, &data);
+        }
+        else if(i2c_use_rdwr(bus)) {
+            unsigned char byte;
+            struct i2c_msg msg = { addr, I2C_M_RD, 1, &byte };
+
+            ret = i2c_transfer(bus, &msg, 1);
+        }
+        else {
+            ret = -EOPNOTSUPP;
+        }
+    }
+    else if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_QUICK)) {
+        ret = i2c_smbus_access(bus, addr, I2C_SMBUS_WRITE, 0,
+                               I2C_SMBUS_QUICK, NULL);
+    }
+    else if(i2c_use_rdwr(bus)) {
+        struct i2c_msg msg = { addr, 0, 0, NULL };
+
+        ret = i2c_transfer(bus, &msg, 1);
+    }
+    else {
+        ret = -EOPNOTSUPP;
+    }
+
+    if(ret == 0) {
+        return SCAN_FOUND;
+    }
+    /* I2C_SLAVE refuses addresses a kernel driver has claimed */
+    return ret == -EBUSY ? SCAN_BUSY : SCAN_NONE;
+}
+
+
+static void *scan_thread(void *arg) {
+    struct scan_job *job = arg;
+    struct i2c_bus *bus = job->shared;
+    uint64_t start;
+    int addr;
+
+    if(!bus) {
+        if((job->error = i2c_bus_open(&job->bus, job->device, job->path)) < 0) {
+            return NULL;
+        }
+        bus = &job->bus;
+        bus->max_retries = job->max_retries;
+        if(job->stats_out) {
+            i2c_stats_enable(bus, job->stats_out);
+        }
+    }
+    /* Both kinds of probe, see scan_probe(), have to be possible */
+    if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_QUICK) &&
+       (i2c_use_smbus(bus, I2C_FUNC_SMBUS_READ_BYTE) || i2c_use_rdwr(bus))) {
+        job->method = "SMBus quick";
+    }
+    else if(i2c_use_rdwr(bus)) {
+        job->method = "zero-length write";
+    }
+    else {
+        job->error = -EOPNOTSUPP;
+        goto out;
+    }
+
+    start = monotonic_ns();
+    for(addr = SCAN_FIRST; addr <= SCAN_LAST; addr++) {
+        job->result[addr] = scan_probe(bus, addr);
+    }
+    job->elapsed = monotonic_ns() - start;
+
+out:
+    if(!job->shared) {
+        i2c_bus_close(&job->bus);
+    }
+    return NULL;
+}
+
+
+static void print_scan_map(const struct scan_job *job) {
+    int row, col;
+
+    printf("%s (%s, %.2f ms):\n", job->device, job->method,
+           job->elapsed / 1e6);
+    printf("     0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f\n");
+    for(row = 0; row < 0x80; row += 16) {
+        printf("%02x:", row);
+        for(col = 0; col < 16; col++) {
+            int addr = row + col;
+
+            if(addr < SCAN_FIRST || addr > SCAN_LAST) {
+                printf("   ");
+            }
+            else if(job->result[addr] == SCAN_FOUND) {
+                printf(" %02x", addr);
+            }
+            else if(job->result[addr] == SCAN_BUSY) {
+                printf(" UU");
+            }
+            else {
+                printf(" --");
+            }
+        }
+        printf("\n");
+    }
+}
+
+
+/*
+ * Scan every bus in [devices] ("/dev/i2c-N" or just "N") concurrently,
+ * or the already open bus when none are given.
+ */
+static int run_scan(struct i2c_bus *bus,
+                    const char *device,
+                    int ndevices,
+                    char **devices) {
+    int njobs = ndevices ? ndevices : 1;
+    struct scan_job *jobs = calloc(njobs, sizeof(*jobs));
+    pthread_t *tids = calloc(njobs, sizeof(*tids));
+    uint64_t start, elapsed;
+    int i, ret = 0;
+
+    if(!jobs || !tids) {
+        free(jobs);
+        free(tids);
+        return 1;
+    }
+
+    for(i = 0; i < njobs; i++) {
+        if(!ndevices) {
+            snprintf(jobs[i].device, sizeof(jobs[i].device), "%s", device);
+            jobs[i].shared = bus;
+        }
+        else if(devices[i][0] >= '0' && devices[i][0] <= '9') {
+            snprintf(jobs[i].device, sizeof(jobs[i].device),
+                     "/dev/i2c-%s", devices[i]);
+        }
+        else {
+            snprintf(jobs[i].device, sizeof(jobs[i].device), "%s", devices[i]);
+        }
+        jobs[i].path        = bus->path;
+        jobs[i].max_retries = bus->max_retries;
+        jobs[i].stats_out   = bus->stats ? bus->stats->out : NULL;
+    }
+
+    start = monotonic_ns();
+    for(i = 0; i < njobs; i++) {
+        pthread_create(&tids[i], NULL, scan_thread, &jobs[i]);
+    }
+    for(i = 0; i < njobs; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    elapsed = monotonic_ns() - start;
+
+    for(i = 0; i < njobs; i++) {
+        if(jobs[i].error) {
+            errno = -jobs[i].error;
+            fprintf(stderr, "%s: ", jobs[i].device);
+            perror("Unable to scan");
+            ret = 1;
+            continue;
+        }
+        print_scan_map(&jobs[i]);
+    }
+    printf("Scanned %d bus(es) in %.2f ms\n", njobs, elapsed / 1e6);
+
+    free(jobs);
+    free(tids);
+    return ret;
+}
+
+
 int main(int argc, char **argv) {
-    int i2c_file;
+    struct i2c_bus bus;
+    enum i2c_path_mode path = PATH_AUTO;
+    int retries = I2C_DEFAULT_RETRIES;
+    FILE *stats_out = NULL;
+    const char *device = I2C_FILE_NAME;
+    char *prog = argv[0];
+
+    // Optional "-d /dev/i2c-N" to pick the bus, e.g. the one i2c-stub created,
+    // and "-p auto|smbus|rdwr" to pin the transfer primitive for benchmarks
+    while(argc > 2 && argv[1][0] == '-') {
+        if(!strcmp(argv[1], "-d")) {
+            device = argv[2];
+        }
+        else if(!strcmp(argv[1], "-r")) {
+            retries = strtol(argv[2], NULL, 0);
+        }
+        else if(!strcmp(argv[1], "-s")) {
+            stats_out = strcmp(argv[2], "-") ? fopen(argv[2], "w") : stderr;
+            if(!stats_out) {
+                perror("Unable to open statistics file");
+                exit(1);
+            }
+        }
+        else if(!strcmp(argv[1], "-p") && !strcmp(argv[2], "smbus")) {
+            path = PATH_SMBUS;
+        }
+        else if(!strcmp(argv[1], "-p") && !strcmp(argv[2], "rdwr")) {
+            path = PATH_RDWR;
+        }
+        else if(strcmp(argv[1], "-p") || strcmp(argv[2], "auto")) {
+            break;
+        }
+        argv += 2;
+        argc -= 2;
+    }
 
     // Open a connection to the I2C userspace control file.
-    if ((i2c_file = open(I2C_FILE_NAME, O_RDWR)) < 0) {
+    if ((errno = -i2c_bus_open(&bus, device, path)) != 0) {
         perror("Unable to open i2c control file");
         exit(1);
     }
+    bus.max_retries = retries;
+    if(stats_out) {
+        i2c_stats_enable(&bus, stats_out);
+        i2c_stats_install_signal();
+    }
 
 
     if(argc > 3 && !strcmp(argv[1], "r")) {
         int addr = strtol(argv[2], NULL, 0);
         int reg = strtol(argv[3], NULL, 0);
         unsigned char value;
-        if(get_i2c_register(i2c_file, addr, reg, &value)) {
+        if(get_i2c_register(&bus, addr, reg, &value)) {
             printf("Unable to get register!\n");
         }
         else {
@@ -152,19 +1347,76 @@ int main(int argc, char **argv) {
         int addr = strtol(argv[2], NULL, 0);
         int reg = strtol(argv[3], NULL, 0);
         int value = strtol(argv[4], NULL, 0);
-        if(set_i2c_register(i2c_file, addr, reg, value)) {
+        if(set_i2c_register(&bus, addr, reg, value)) {
             printf("Unable to get register!\n");
         }
         else {
             printf("Set register %x: %d (%x)\n", reg, value, value);
         }
     }
+    else if(argc > 4 && !strcmp(argv[1], "bench")) {
+        int addr = strtol(argv[2], NULL, 0);
+        int reg = strtol(argv[3], NULL, 0);
+        long count = strtol(argv[4], NULL, 0);
+        const char *mix = argc > 5 ? argv[5] : "s";
+        int len = argc > 6 ? strtol(argv[6], NULL, 0) : BENCH_DEFAULT_LEN;
+        if(run_bench(&bus, device, addr, reg, count, mix, len)) {
+            printf("Unable to run benchmark!\n");
+        }
+    }
+    else if(argc > 6 && !strcmp(argv[1], "sample")) {
+        int addr = strtol(argv[2], NULL, 0);
+        double rate = strtod(argv[4], NULL);
+        long count = strtol(argv[5], NULL, 0);
+        int csv = argc > 7 && !strcmp(argv[7], "csv");
+        if(run_sample(&bus, addr, argv[3], rate, count, argv[6], csv)) {
+            printf("Unable to sample registers!\n");
+        }
+    }
+    else if(argc > 5 && !strcmp(argv[1], "dump")) {
+        int addr = strtol(argv[2], NULL, 0);
+        int reg = strtol(argv[3], NULL, 0);
+        int count = strtol(argv[4], NULL, 0);
+        if(run_dump(&bus, addr, reg, count, argv[5])) {
+            printf("Unable to dump registers!\n");
+        }
+    }
+    else if(argc > 3 && !strcmp(argv[1], "restore")) {
+        int addr = strtol(argv[2], NULL, 0);
+        if(run_restore(&bus, addr, argv[3])) {
+            printf("Unable to restore registers!\n");
+        }
+    }
+    else if(argc > 3 && !strcmp(argv[1], "program")) {
+        int addr = strtol(argv[2], NULL, 0);
+        int page = argc > 4 ? strtol(argv[4], NULL, 0) : 16;
+        int addr_bytes = argc > 5 ? strtol(argv[5], NULL, 0) : 1;
+        unsigned int offset = argc > 6 ? strtoul(argv[6], NULL, 0) : 0;
+        if(run_program(&bus, addr, argv[3], page, addr_bytes, offset)) {
+            printf("Unable to program EEPROM!\n");
+        }
+    }
+    else if(argc > 5 && !strcmp(argv[1], "async")) {
+        int addr = strtol(argv[2], NULL, 0);
+        int reg = strtol(argv[3], NULL, 0);
+        int threads = strtol(argv[4], NULL, 0);
+        long count = strtol(argv[5], NULL, 0);
+        int len = argc > 6 ? strtol(argv[6], NULL, 0) : 1;
+        if(run_async_bench(&bus, addr, reg, threads, count, len)) {
+            printf("Unable to run benchmark!\n");
+        }
+    }
+    else if(argc > 1 && !strcmp(argv[1], "scan")) {
+        if(run_scan(&bus, device, argc - 2, argv + 2)) {
+            printf("Unable to scan!\n");
+        }
+    }
     else {
-        fprintf(stderr, USAGE_MESSAGE, argv[0], argv[0]);
+        fprintf(stderr, USAGE_MESSAGE, prog);
     }
 
 
-    close(i2c_file);
+    i2c_bus_close(&bus);
 
 
     return 0;
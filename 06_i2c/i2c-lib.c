@@ -0,0 +1,1024 @@
+/*
+ This software uses a BSD license.
+
+Copyright (c) 2010, Sean Cross / chumby industries
+All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ * Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.  
+ * Neither the name of Sean Cross / chumby industries nor the names
+   of its contributors may be used to endorse or promote products
+   derived from this software without specific prior written
+   permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ */
+
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "i2c-lib.h"
+
+
+const char *i2c_path_names[] = { "auto", "smbus", "rdwr" };
+
+static const char *i2c_op_names[I2C_NR_OPS] = {
+    "read", "write", "quick", "batch"
+};
+
+/* Bumped by SIGUSR1; each bus dumps once per generation it sees */
+static volatile sig_atomic_t i2c_stats_generation;
+/* Self-pipe SIGUSR1 writes to, so waits can watch for it */
+static int i2c_stats_pipe[2] = { -1, -1 };
+
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static int hist_bucket(uint64_t ns) {
+    int msb;
+
+    if(ns < HIST_SUB_COUNT) {
+        return (int)ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+           (int)((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+
+/* Smallest latency that falls into [bucket] */
+static uint64_t hist_bucket_floor(int bucket) {
+    int exp = bucket >> HIST_SUB_BITS;
+    uint64_t sub = bucket & (HIST_SUB_COUNT - 1);
+
+    if(exp == 0) {
+        return sub;
+    }
+    return (HIST_SUB_COUNT + sub) << (exp - 1);
+}
+
+
+void hist_add(struct lat_hist *hist, uint64_t ns) {
+    hist->count[hist_bucket(ns)]++;
+    if(hist->total == 0 || ns < hist->min_ns) {
+        hist->min_ns = ns;
+    }
+    if(ns > hist->max_ns) {
+        hist->max_ns = ns;
+    }
+    hist->total++;
+}
+
+
+/* Latency at quantile [q]; reports the top of the bucket it falls into */
+uint64_t hist_quantile(const struct lat_hist *hist, double q) {
+    unsigned long long rank, seen = 0;
+    int i;
+
+    if(hist->total == 0) {
+        return 0;
+    }
+    rank = (unsigned long long)(q * hist->total);
+    if(rank >= hist->total) {
+        rank = hist->total - 1;
+    }
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->count[i];
+        if(seen > rank) {
+            uint64_t top = hist_bucket_floor(i + 1) - 1;
+            return top < hist->max_ns ? top : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+
+
+static void i2c_stats_sigusr1(int sig) {
+    int saved = errno;
+
+    (void)sig;
+    i2c_stats_generation++;
+    if(i2c_stats_pipe[1] >= 0 && write(i2c_stats_pipe[1], "", 1) < 0) {
+        /* full: a wakeup is pending already */
+    }
+    errno = saved;
+}
+
+
+void i2c_stats_install_signal(void) {
+    struct sigaction sa;
+
+    if(i2c_stats_pipe[0] < 0 && pipe(i2c_stats_pipe) == 0) {
+        int i;
+
+        for(i = 0; i < 2; i++) {
+            fcntl(i2c_stats_pipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(i2c_stats_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = i2c_stats_sigusr1;
+    sa.sa_flags   = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+
+int i2c_stats_enable(struct i2c_bus *bus, FILE *out) {
+    if(!bus->stats && !(bus->stats = calloc(1, sizeof(*bus->stats)))) {
+        return -ENOMEM;
+    }
+    bus->stats->out     = out;
+    bus->stats->dumped  = i2c_stats_generation;
+
+    return 0;
+}
+
+
+/*
+ * Print the statistics of [bus] as one JSON object per line:
+ * {"device":..,"addrs":{"0x50":{"read":{"count":..,...},...},...}}
+ */
+void i2c_stats_dump(struct i2c_bus *bus, FILE *out) {
+    struct i2c_stats *stats = bus->stats;
+    int addr, op, first_addr = 1;
+
+    if(!stats) {
+        return;
+    }
+
+    /* Buses of other threads may share [out]; keep each line whole */
+    flockfile(out);
+    fprintf(out, "{\"device\":\"%s\",\"max_retries\":%d,\"addrs\":{",
+            bus->device, bus->max_retries);
+    for(addr = 0; addr < 128; addr++) {
+        int first_op = 1;
+
+        for(op = 0; op < I2C_NR_OPS; op++) {
+            struct i2c_op_stats *st = stats->op[addr][op];
+
+            if(!st) {
+                continue;
+            }
+            if(first_op) {
+                fprintf(out, "%s\"0x%02x\":{", first_addr ? "" : ",", addr);
+                first_addr = 0;
+            }
+            fprintf(out, "%s\"%s\":{\"count\":%llu,\"errors\":%llu,"
+                    "\"nacks\":%llu,\"timeouts\":%llu,\"retries\":%llu,"
+                    "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+                    "\"max_ns\":%llu}",
+                    first_op ? "" : ",", i2c_op_names[op],
+                    st->count, st->errors, st->nacks, st->timeouts,
+                    st->retries,
+                    (unsigned long long)hist_quantile(&st->hist, 0.50),
+                    (unsigned long long)hist_quantile(&st->hist, 0.99),
+                    (unsigned long long)hist_quantile(&st->hist, 0.999),
+                    (unsigned long long)st->hist.max_ns);
+            first_op = 0;
+        }
+        if(!first_op) {
+            fprintf(out, "}");
+        }
+    }
+    fprintf(out, "}}\n");
+    fflush(out);
+    funlockfile(out);
+}
+
+
+/* Dump [bus] once if SIGUSR1 arrived since its last dump */
+static void i2c_stats_check(struct i2c_bus *bus) {
+    struct i2c_stats *stats = bus->stats;
+
+    if(stats->dumped != (unsigned long)i2c_stats_generation) {
+        stats->dumped = i2c_stats_generation;
+        i2c_stats_dump(bus, stats->out);
+    }
+}
+
+
+/* Account one transaction that started at [start] and ended with [ret] */
+static void i2c_stats_record(struct i2c_bus *bus,
+                             unsigned char addr,
+                             enum i2c_stats_op op,
+                             uint64_t start,
+                             int ret,
+                             int retries) {
+    struct i2c_stats *stats = bus->stats;
+    struct i2c_op_stats *st;
+
+    if(!stats) {
+        return;
+    }
+
+    addr &= 0x7f;
+    if(!(st = stats->op[addr][op]) &&
+       !(st = stats->op[addr][op] = calloc(1, sizeof(*st)))) {
+        return;
+    }
+    hist_add(&st->hist, monotonic_ns() - start);
+    st->count++;
+    st->retries += retries;
+    if(ret < 0) {
+        st->errors++;
+        if(ret == -ENXIO || ret == -EREMOTEIO) {
+            st->nacks++;
+        }
+        else if(ret == -ETIMEDOUT) {
+            st->timeouts++;
+        }
+    }
+
+    /* SIGUSR1 only bumps a counter; dump here, outside signal context */
+    i2c_stats_check(bus);
+}
+
+
+int i2c_stats_signal_fd(void) {
+    return i2c_stats_pipe[0];
+}
+
+
+void i2c_stats_poll(struct i2c_bus *bus) {
+    char buf[64];
+
+    if(i2c_stats_pipe[0] >= 0) {
+        while(read(i2c_stats_pipe[0], buf, sizeof(buf)) > 0) {
+        }
+    }
+    if(bus->stats) {
+        i2c_stats_check(bus);
+    }
+}
+
+
+/*
+ * Lost arbitration and bus timeouts are worth another try; a NACK means
+ * nobody is there (or a busy EEPROM, which callers poll for themselves).
+ */
+static int i2c_retryable(int ret) {
+    return ret == -EAGAIN || ret == -ETIMEDOUT;
+}
+
+
+static void i2c_backoff(int attempt) {
+    struct timespec ts;
+    long us = (long)I2C_RETRY_BACKOFF_US << attempt;
+
+    ts.tv_sec  = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+
+int i2c_bus_open(struct i2c_bus *bus, const char *device,
+                 enum i2c_path_mode path) {
+    if((bus->fd = open(device, O_RDWR)) < 0) {
+        return -errno;
+    }
+    snprintf(bus->device, sizeof(bus->device), "%s", device);
+    bus->path        = path;
+    bus->slave_addr  = -1;
+    bus->max_retries = I2C_DEFAULT_RETRIES;
+    bus->stats       = NULL;
+
+    // Ask once what the adapter can do; without an answer stick to I2C_RDWR
+    if(ioctl(bus->fd, I2C_FUNCS, &bus->funcs) < 0) {
+        bus->funcs = I2C_FUNC_I2C;
+    }
+
+    return 0;
+}
+
+
+void i2c_bus_close(struct i2c_bus *bus) {
+    if(bus->stats) {
+        int addr, op;
+
+        i2c_stats_dump(bus, bus->stats->out);
+        for(addr = 0; addr < 128; addr++) {
+            for(op = 0; op < I2C_NR_OPS; op++) {
+                free(bus->stats->op[addr][op]);
+            }
+        }
+        free(bus->stats);
+        bus->stats = NULL;
+    }
+    close(bus->fd);
+    bus->fd = -1;
+}
+
+
+/* Classify an I2C_RDWR message list for the statistics */
+static enum i2c_stats_op i2c_rdwr_op(const struct i2c_msg *messages,
+                                     int nmsgs) {
+    if(nmsgs == 1) {
+        if(messages[0].flags & I2C_M_RD) {
+            return I2C_OP_READ;
+        }
+        return messages[0].len ? I2C_OP_WRITE : I2C_OP_QUICK;
+    }
+    if(nmsgs == 2 && !(messages[0].flags & I2C_M_RD) &&
+       (messages[1].flags & I2C_M_RD)) {
+        return I2C_OP_READ;
+    }
+    return I2C_OP_BATCH;
+}
+
+
+/*
+ * Run a prepared list of messages as one I2C_RDWR call.  The transfer
+ * helpers below stay quiet and return -errno, so callers that count
+ * failures (the benchmark) don't flood the terminal.
+ */
+int i2c_transfer(struct i2c_bus *bus, struct i2c_msg *messages, int nmsgs) {
+    struct i2c_rdwr_ioctl_data packets;
+    uint64_t start = bus->stats ? monotonic_ns() : 0;
+    int ret, attempt = 0;
+
+    packets.msgs  = messages;
+    packets.nmsgs = nmsgs;
+    while((ret = ioctl(bus->fd, I2C_RDWR, &packets) < 0 ? -errno : 0) < 0 &&
+          i2c_retryable(ret) && attempt < bus->max_retries) {
+        i2c_backoff(attempt++);
+    }
+    i2c_stats_record(bus, messages[0].addr, i2c_rdwr_op(messages, nmsgs),
+                     start, ret, attempt);
+
+    return ret;
+}
+
+
+static int rdwr_set_register(struct i2c_bus *bus,
+                             unsigned char addr,
+                             unsigned char reg,
+                             unsigned char value) {
+
+    unsigned char outbuf[2];
+    struct i2c_msg messages[1];
+
+    messages[0].addr  = addr;
+    messages[0].flags = 0;
+    messages[0].len   = sizeof(outbuf);
+    messages[0].buf   = outbuf;
+
+    /* The first byte indicates which register we'll write */
+    outbuf[0] = reg;
+
+    /* 
+     * The second byte indicates the value to write.  Note that for many
+     * devices, we can write multiple, sequential registers at once by
+     * simply making outbuf bigger.
+     */
+    outbuf[1] = value;
+
+    /* Transfer the i2c packets to the kernel and verify it worked */
+    return i2c_transfer(bus, messages, 1);
+}
+
+
+/* Read [len] consecutive registers starting at [reg] in one transfer */
+int get_i2c_block(struct i2c_bus *bus,
+                  unsigned char addr,
+                  unsigned char reg,
+                  unsigned char *buf,
+                  unsigned short len) {
+    unsigned char outbuf = reg;
+    struct i2c_msg messages[2];
+
+    /*
+     * In order to read a register, we first do a "dummy write" by writing
+     * 0 bytes to the register we want to read from.  This is similar to
+     * the packet in rdwr_set_register, except it's 1 byte rather than 2.
+     */
+    messages[0].addr  = addr;
+    messages[0].flags = 0;
+    messages[0].len   = sizeof(outbuf);
+    messages[0].buf   = &outbuf;
+
+    /* The data will get returned in this buffer */
+    messages[1].addr  = addr;
+    messages[1].flags = I2C_M_RD/* | I2C_M_NOSTART*/;
+    messages[1].len   = len;
+    messages[1].buf   = buf;
+
+    /* Send the request to the kernel and get the result back */
+    return i2c_transfer(bus, messages, 2);
+}
+
+
+/*
+ * SMBus transfers go through I2C_SMBUS, which takes the slave address from
+ * the file descriptor rather than from each message.  Remember the last
+ * address we bound so back-to-back transactions don't pay for I2C_SLAVE.
+ */
+static int select_slave(struct i2c_bus *bus, unsigned char addr) {
+    if(bus->slave_addr == addr) {
+        return 0;
+    }
+    if(ioctl(bus->fd, I2C_SLAVE, addr) < 0) {
+        bus->slave_addr = -1;
+        return -errno;
+    }
+    bus->slave_addr = addr;
+
+    return 0;
+}
+
+
+int i2c_smbus_access(struct i2c_bus *bus,
+                     unsigned char addr,
+                     char read_write,
+                     unsigned char command,
+                     int size,
+                     union i2c_smbus_data *data) {
+    struct i2c_smbus_ioctl_data args;
+    uint64_t start = bus->stats ? monotonic_ns() : 0;
+    int ret, attempt = 0;
+
+    if((ret = select_slave(bus, addr)) < 0) {
+        return ret;
+    }
+
+    args.read_write = read_write;
+    args.command    = command;
+    args.size       = size;
+    args.data       = data;
+    while((ret = ioctl(bus->fd, I2C_SMBUS, &args) < 0 ? -errno : 0) < 0 &&
+          i2c_retryable(ret) && attempt < bus->max_retries) {
+        i2c_backoff(attempt++);
+    }
+    i2c_stats_record(bus, addr,
+                     size == I2C_SMBUS_QUICK ? I2C_OP_QUICK :
+                     read_write == I2C_SMBUS_READ ? I2C_OP_READ : I2C_OP_WRITE,
+                     start, ret, attempt);
+
+    return ret;
+}
+
+
+/*
+ * Decide whether a request can take the SMBus primitive [func].  SMBus
+ * calls skip the message array copy-in of I2C_RDWR and map straight onto
+ * adapters with a native SMBus controller, so they win whenever offered.
+ * The choice is made on capability only: a failed SMBus call returns its
+ * own error rather than being sent again over I2C_RDWR, where a write
+ * that did land would be repeated.  PATH_SMBUS never uses I2C_RDWR, the
+ * helpers return -EOPNOTSUPP for what the adapter lacks.
+ */
+int i2c_use_smbus(struct i2c_bus *bus, unsigned long func) {
+    if(bus->path == PATH_RDWR) {
+        return 0;
+    }
+    return (bus->funcs & func) == func;
+}
+
+
+/*
+ * Whether raw I2C_RDWR transfers may be used at all: not on PATH_SMBUS
+ * and not on adapters that only speak SMBus.  Callers with no SMBus
+ * alternative return -EOPNOTSUPP otherwise.
+ */
+int i2c_use_rdwr(struct i2c_bus *bus) {
+    return bus->path != PATH_SMBUS && (bus->funcs & I2C_FUNC_I2C);
+}
+
+
+int i2c_write_byte(struct i2c_bus *bus,
+                   unsigned char addr,
+                   unsigned char reg,
+                   unsigned char value) {
+    if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_WRITE_BYTE_DATA)) {
+        union i2c_smbus_data data;
+
+        data.byte = value;
+        return i2c_smbus_access(bus, addr, I2C_SMBUS_WRITE, reg,
+                                I2C_SMBUS_BYTE_DATA, &data);
+    }
+    if(bus->path == PATH_SMBUS) {
+        return -EOPNOTSUPP;
+    }
+    return rdwr_set_register(bus, addr, reg, value);
+}
+
+
+int i2c_read_byte(struct i2c_bus *bus,
+                  unsigned char addr,
+                  unsigned char reg,
+                  unsigned char *val) {
+    if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_READ_BYTE_DATA)) {
+        union i2c_smbus_data data;
+        int ret;
+
+        ret = i2c_smbus_access(bus, addr, I2C_SMBUS_READ, reg,
+                           I2C_SMBUS_BYTE_DATA, &data);
+        if(ret == 0) {
+            *val = data.byte;
+        }
+        return ret;
+    }
+    if(bus->path == PATH_SMBUS) {
+        return -EOPNOTSUPP;
+    }
+    return get_i2c_block(bus, addr, reg, val, 1);
+}
+
+
+/* Read a 16-bit register pair; SMBus words are sent low byte first */
+int i2c_read_word(struct i2c_bus *bus,
+                  unsigned char addr,
+                  unsigned char reg,
+                  unsigned short *val) {
+    unsigned char buf[2];
+    int ret;
+
+    if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_READ_WORD_DATA)) {
+        union i2c_smbus_data data;
+
+        ret = i2c_smbus_access(bus, addr, I2C_SMBUS_READ, reg,
+                           I2C_SMBUS_WORD_DATA, &data);
+        if(ret == 0) {
+            *val = data.word;
+        }
+        return ret;
+    }
+    if(bus->path == PATH_SMBUS) {
+        return -EOPNOTSUPP;
+    }
+    if((ret = get_i2c_block(bus, addr, reg, buf, sizeof(buf))) < 0) {
+        return ret;
+    }
+    *val = buf[0] | (buf[1] << 8);
+
+    return 0;
+}
+
+
+/*
+ * Read [len] consecutive registers.  Up to 32 bytes fit one SMBus
+ * I2C-block read; anything longer (or an adapter without it) is a single
+ * I2C_RDWR write/read pair, unless the path is pinned to SMBus.
+ */
+int i2c_read_block(struct i2c_bus *bus,
+                   unsigned char addr,
+                   unsigned char reg,
+                   unsigned char *buf,
+                   unsigned short len) {
+    if(len <= I2C_SMBUS_BLOCK_MAX &&
+       i2c_use_smbus(bus, I2C_FUNC_SMBUS_READ_I2C_BLOCK)) {
+        union i2c_smbus_data data;
+        int ret;
+
+        data.block[0] = len;
+        ret = i2c_smbus_access(bus, addr, I2C_SMBUS_READ, reg,
+                           I2C_SMBUS_I2C_BLOCK_DATA, &data);
+        if(ret < 0) {
+            return ret;
+        }
+        if(data.block[0] < len) {
+            return -EIO;
+        }
+        memcpy(buf, &data.block[1], len);
+        return 0;
+    }
+    if(bus->path == PATH_SMBUS) {
+        return -EOPNOTSUPP;
+    }
+    return get_i2c_block(bus, addr, reg, buf, len);
+}
+
+
+/*
+ * SMBus block read: the device sends its own byte count first.  Returns
+ * the number of data bytes copied to [buf] (at most 32) or -errno.  The
+ * raw fallback reads the largest possible block and trims it by count.
+ */
+int i2c_read_smbus_block(struct i2c_bus *bus,
+                         unsigned char addr,
+                         unsigned char reg,
+                         unsigned char *buf) {
+    unsigned char raw[I2C_SMBUS_BLOCK_MAX + 1];
+    int ret;
+
+    if(i2c_use_smbus(bus, I2C_FUNC_SMBUS_READ_BLOCK_DATA)) {
+        union i2c_smbus_data data;
+
+        ret = i2c_smbus_access(bus, addr, I2C_SMBUS_READ, reg,
+                           I2C_SMBUS_BLOCK_DATA, &data);
+        if(ret < 0) {
+            return ret;
+        }
+        memcpy(buf, &data.block[1], data.block[0]);
+        return data.block[0];
+    }
+    if(bus->path == PATH_SMBUS) {
+        return -EOPNOTSUPP;
+    }
+    if((ret = get_i2c_block(bus, addr, reg, raw, sizeof(raw))) < 0) {
+        return ret;
+    }
+    if(raw[0] > I2C_SMBUS_BLOCK_MAX) {
+        return -EPROTO;
+    }
+    memcpy(buf, &raw[1], raw[0]);
+
+    return raw[0];
+}
+
+
+/*
+ * Write [len] consecutive registers starting at [reg].  SMBus I2C-block
+ * writes carry up to 32 bytes; longer runs go out as one I2C_RDWR message
+ * of register number followed by the data.
+ */
+int i2c_write_block(struct i2c_bus *bus,
+                    unsigned char addr,
+                    unsigned char reg,
+                    const unsigned char *buf,
+                    unsigned short len) {
+    unsigned char outbuf[256 + 1];
+    struct i2c_msg messages[1];
+
+    if(len <= I2C_SMBUS_BLOCK_MAX &&
+       i2c_use_smbus(bus, I2C_FUNC_SMBUS_WRITE_I2C_BLOCK)) {
+        union i2c_smbus_data data;
+
+        data.block[0] = len;
+        memcpy(&data.block[1], buf, len);
+        return i2c_smbus_access(bus, addr, I2C_SMBUS_WRITE, reg,
+                                I2C_SMBUS_I2C_BLOCK_DATA, &data);
+    }
+    if(bus->path == PATH_SMBUS) {
+        return -EOPNOTSUPP;
+    }
+    if(len > sizeof(outbuf) - 1) {
+        return -EINVAL;
+    }
+
+    outbuf[0] = reg;
+    memcpy(&outbuf[1], buf, len);
+    messages[0].addr  = addr;
+    messages[0].flags = 0;
+    messages[0].len   = len + 1;
+    messages[0].buf   = outbuf;
+
+    return i2c_transfer(bus, messages, 1);
+}
+
+
+/*
+ * Largest block the current path moves in one transaction: SMBus caps
+ * I2C-block transfers at 32 bytes, I2C_RDWR can take the whole map.
+ */
+unsigned short i2c_block_limit(struct i2c_bus *bus, unsigned long func) {
+    return i2c_use_smbus(bus, func) ? I2C_SMBUS_BLOCK_MAX : 256;
+}
+
+
+/* Read [count] registers from [reg] in as few block reads as possible */
+int i2c_read_range(struct i2c_bus *bus,
+                   unsigned char addr,
+                   unsigned char reg,
+                   unsigned char *buf,
+                   int count) {
+    unsigned short chunk = i2c_block_limit(bus, I2C_FUNC_SMBUS_READ_I2C_BLOCK);
+    int done = 0, ret;
+
+    while(done < count) {
+        unsigned short len = count - done < chunk ? count - done : chunk;
+
+        ret = i2c_read_block(bus, addr, reg + done, buf + done, len);
+        if(ret < 0) {
+            return ret;
+        }
+        done += len;
+    }
+
+    return 0;
+}
+
+
+int set_i2c_register(struct i2c_bus *bus,
+                     unsigned char addr,
+                     unsigned char reg,
+                     unsigned char value) {
+    int ret;
+
+    if((ret = i2c_write_byte(bus, addr, reg, value)) < 0) {
+        errno = -ret;
+        perror("Unable to send data");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int get_i2c_register(struct i2c_bus *bus,
+                     unsigned char addr,
+                     unsigned char reg,
+                     unsigned char *val) {
+    int ret;
+
+    if((ret = i2c_read_byte(bus, addr, reg, val)) < 0) {
+        errno = -ret;
+        perror("Unable to send data");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Read [n] independent registers with a single ioctl: each register is a
+ * write/read message pair, and the kernel runs the whole list as one
+ * combined transaction with repeated starts.
+ */
+int get_i2c_register_batch(struct i2c_bus *bus,
+                           unsigned char addr,
+                           const unsigned char *regs,
+                           unsigned char *vals,
+                           int n) {
+    struct i2c_msg messages[I2C_RDWR_IOCTL_MAX_MSGS];
+    int i;
+
+    if(n <= 0 || n > I2C_MAX_BATCH) {
+        return -EINVAL;
+    }
+
+    /* Without I2C_RDWR the batch falls apart into single register reads */
+    if(!i2c_use_rdwr(bus)) {
+        int ret;
+
+        for(i = 0; i < n; i++) {
+            if((ret = i2c_read_byte(bus, addr, regs[i], &vals[i])) < 0) {
+                return ret;
+            }
+        }
+        return 0;
+    }
+
+    for(i = 0; i < n; i++) {
+        messages[2 * i].addr      = addr;
+        messages[2 * i].flags     = 0;
+        messages[2 * i].len       = 1;
+        messages[2 * i].buf       = (unsigned char *)&regs[i];
+
+        messages[2 * i + 1].addr  = addr;
+        messages[2 * i + 1].flags = I2C_M_RD;
+        messages[2 * i + 1].len   = 1;
+        messages[2 * i + 1].buf   = &vals[i];
+    }
+
+    return i2c_transfer(bus, messages, 2 * n);
+}
+
+
+
+
+/* Number of I2C_RDWR messages [req] turns into */
+static int i2c_request_msgs(const struct i2c_request *req) {
+    return req->write ? 1 : 2;
+}
+
+
+/* Run one request on its own through the cheapest primitive */
+static int i2c_async_run_one(struct i2c_bus *bus, struct i2c_request *req) {
+    if(req->write) {
+        return i2c_write_block(bus, req->addr, req->reg, req->buf, req->len);
+    }
+    return i2c_read_block(bus, req->addr, req->reg, req->buf, req->len);
+}
+
+
+/*
+ * Run a list of requests: one write, or any number of reads.  When the
+ * adapter speaks plain I2C a list of reads becomes one combined I2C_RDWR
+ * transfer with repeated starts, so the caller pays one ioctl and one
+ * bus arbitration for all of them.  A NACK anywhere aborts the combined
+ * transfer without telling us which message failed, so a failed batch
+ * is replayed one request at a time to give every request its own
+ * status.  Only reads may be replayed like that: a write that went
+ * through before the NACK would reach the device twice, so writes are
+ * never batched (see i2c_async_worker()).  Counters go to [stats] so the
+ * worker can fold them in under its lock.
+ */
+static void i2c_async_run_batch(struct i2c_bus *bus,
+                                struct i2c_request *batch,
+                                struct i2c_async_stats *stats) {
+    unsigned char wbuf[I2C_RDWR_IOCTL_MAX_MSGS / 2];
+    struct i2c_msg messages[I2C_RDWR_IOCTL_MAX_MSGS];
+    struct i2c_request *req;
+    int nmsgs = 0, nreqs = 0, ret;
+
+    if(!batch->next || !i2c_use_rdwr(bus)) {
+        for(req = batch; req; req = req->next) {
+            req->status = i2c_async_run_one(bus, req);
+        }
+        return;
+    }
+
+    for(req = batch; req; req = req->next) {
+        wbuf[nreqs] = req->reg;
+        messages[nmsgs].addr  = req->addr;
+        messages[nmsgs].flags = 0;
+        messages[nmsgs].len   = 1;
+        messages[nmsgs].buf   = &wbuf[nreqs];
+        nmsgs++;
+        messages[nmsgs].addr  = req->addr;
+        messages[nmsgs].flags = I2C_M_RD;
+        messages[nmsgs].len   = req->len;
+        messages[nmsgs].buf   = req->buf;
+        nmsgs++;
+        nreqs++;
+    }
+
+    ret = i2c_transfer(bus, messages, nmsgs);
+    stats->batches++;
+    stats->batched_requests += nreqs;
+    if(ret == 0) {
+        for(req = batch; req; req = req->next) {
+            req->status = 0;
+        }
+        return;
+    }
+
+    stats->replays++;
+    for(req = batch; req; req = req->next) {
+        req->status = i2c_async_run_one(bus, req);
+    }
+}
+
+
+static void *i2c_async_worker(void *arg) {
+    struct i2c_async *async = arg;
+
+    pthread_mutex_lock(&async->lock);
+    for(;;) {
+        struct i2c_request *batch, *last, *req, *next;
+        struct i2c_async_stats delta = { 0, 0, 0, 0 };
+        int nmsgs;
+
+        while(!async->head && !async->stopping) {
+            pthread_cond_wait(&async->queued, &async->lock);
+        }
+        if(!async->head) {
+            break;
+        }
+
+        /*
+         * Take a write on its own, or as many queued reads as fit into
+         * one I2C_RDWR call; the next write ends the batch
+         */
+        batch = last = async->head;
+        nmsgs = i2c_request_msgs(batch);
+        while(!batch->write && last->next && !last->next->write &&
+              nmsgs + i2c_request_msgs(last->next) <= I2C_RDWR_IOCTL_MAX_MSGS) {
+            last = last->next;
+            nmsgs += i2c_request_msgs(last);
+        }
+        async->head = last->next;
+        if(!async->head) {
+            async->tail = NULL;
+        }
+        last->next = NULL;
+        pthread_mutex_unlock(&async->lock);
+
+        i2c_async_run_batch(async->bus, batch, &delta);
+
+        /*
+         * Complete the requests.  A callback owns its request from the
+         * moment it runs, so fetch the next pointer first.
+         */
+        for(req = batch; req; req = next) {
+            next = req->next;
+            if(req->callback) {
+                req->callback(req, req->arg);
+            }
+            else {
+                pthread_mutex_lock(&async->lock);
+                req->done = 1;
+                pthread_cond_broadcast(&async->completed);
+                pthread_mutex_unlock(&async->lock);
+            }
+        }
+
+        pthread_mutex_lock(&async->lock);
+        async->stats.batches          += delta.batches;
+        async->stats.batched_requests += delta.batched_requests;
+        async->stats.replays          += delta.replays;
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    return NULL;
+}
+
+
+int i2c_async_start(struct i2c_async *async, struct i2c_bus *bus) {
+    memset(async, 0, sizeof(*async));
+    async->bus = bus;
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->queued, NULL);
+    pthread_cond_init(&async->completed, NULL);
+
+    return -pthread_create(&async->thread, NULL, i2c_async_worker, async);
+}
+
+
+void i2c_async_stop(struct i2c_async *async) {
+    pthread_mutex_lock(&async->lock);
+    async->stopping = 1;
+    pthread_cond_signal(&async->queued);
+    pthread_mutex_unlock(&async->lock);
+
+    pthread_join(async->thread, NULL);
+    pthread_cond_destroy(&async->completed);
+    pthread_cond_destroy(&async->queued);
+    pthread_mutex_destroy(&async->lock);
+}
+
+
+int i2c_async_submit(struct i2c_async *async, struct i2c_request *req) {
+    if(req->len == 0 || req->len > I2C_ASYNC_MAX_LEN) {
+        return -EINVAL;
+    }
+
+    req->status = 0;
+    req->done   = 0;
+    req->async  = async;
+    req->next   = NULL;
+
+    pthread_mutex_lock(&async->lock);
+    if(async->stopping) {
+        pthread_mutex_unlock(&async->lock);
+        return -ESHUTDOWN;
+    }
+    if(async->tail) {
+        async->tail->next = req;
+    }
+    else {
+        async->head = req;
+    }
+    async->tail = req;
+    async->stats.requests++;
+    pthread_cond_signal(&async->queued);
+    pthread_mutex_unlock(&async->lock);
+
+    return 0;
+}
+
+
+int i2c_async_wait(struct i2c_request *req) {
+    struct i2c_async *async = req->async;
+
+    pthread_mutex_lock(&async->lock);
+    while(!req->done) {
+        pthread_cond_wait(&async->completed, &async->lock);
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    return req->status;
+}
+
+
+void i2c_async_get_stats(struct i2c_async *async,
+                         struct i2c_async_stats *stats) {
+    pthread_mutex_lock(&async->lock);
+    *stats = async->stats;
+    pthread_mutex_unlock(&async->lock);
+}
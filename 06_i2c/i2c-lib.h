@@ -0,0 +1,250 @@
+/*
+ * i2c-lib: I2C transfer helpers shared by i2c-app and other tools.
+ *
+ * Synchronous helpers return 0 (or a byte count where noted) on success
+ * and -errno on failure without printing anything, except
+ * set_i2c_register()/get_i2c_register() which keep the old perror()
+ * behaviour and return 1.
+ *
+ * The asynchronous API runs all transfers of one bus on a worker thread.
+ * Reads queued while the bus is busy are coalesced into a single
+ * I2C_RDWR call; writes always go out on their own.
+ *
+ * Build: gcc -o i2c-app i2c-app.c i2c-lib.c -lpthread
+ */
+#ifndef I2C_LIB_H
+#define I2C_LIB_H
+
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/*
+ * Latency histogram with 16 linear sub-buckets per power of two, so any
+ * percentile is reported within ~6% of the real value whatever the range.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_COUNT)
+
+struct lat_hist {
+    unsigned long long count[HIST_BUCKETS];
+    unsigned long long total;
+    uint64_t min_ns;
+    uint64_t max_ns;
+};
+
+uint64_t monotonic_ns(void);
+void hist_add(struct lat_hist *hist, uint64_t ns);
+/* Latency at quantile [q]; reports the top of the bucket it falls into */
+uint64_t hist_quantile(const struct lat_hist *hist, double q);
+
+
+/* Which transfer primitive a request may use, see i2c_use_smbus() */
+enum i2c_path_mode {
+    PATH_AUTO,
+    PATH_SMBUS,
+    PATH_RDWR
+};
+
+extern const char *i2c_path_names[];
+
+/*
+ * Per-transaction instrumentation.  Every I2C_RDWR and I2C_SMBUS call is
+ * counted per slave address and operation, with its NACKs, timeouts,
+ * retries and a latency histogram.  Tables are allocated on first use, so
+ * a bus that talks to two devices only pays for two.
+ */
+enum i2c_stats_op {
+    I2C_OP_READ,
+    I2C_OP_WRITE,
+    I2C_OP_QUICK,
+    /* I2C_RDWR calls carrying more than one register access */
+    I2C_OP_BATCH,
+    I2C_NR_OPS
+};
+
+struct i2c_op_stats {
+    unsigned long long count;
+    unsigned long long errors;
+    unsigned long long nacks;
+    unsigned long long timeouts;
+    unsigned long long retries;
+    struct lat_hist hist;
+};
+
+struct i2c_stats {
+    struct i2c_op_stats *op[128][I2C_NR_OPS];
+    /* where to dump on close and on SIGUSR1 */
+    FILE *out;
+    /* last SIGUSR1 generation this bus has dumped */
+    unsigned long dumped;
+};
+
+/* Retries for transient errors (arbitration loss, timeouts) */
+#define I2C_DEFAULT_RETRIES 2
+#define I2C_RETRY_BACKOFF_US 100
+
+/* An open i2c-dev node */
+struct i2c_bus {
+    int fd;
+    char device[64];
+    /* Adapter capabilities, queried once with I2C_FUNCS at open */
+    unsigned long funcs;
+    enum i2c_path_mode path;
+    /* Address last bound with I2C_SLAVE, or -1 */
+    int slave_addr;
+    /* bounded retries, backing off 100us, 200us, ... */
+    int max_retries;
+    /* NULL unless i2c_stats_enable() was called */
+    struct i2c_stats *stats;
+};
+
+/* A batched read takes two messages (register write + data read) */
+#define I2C_MAX_BATCH (I2C_RDWR_IOCTL_MAX_MSGS / 2)
+
+int i2c_bus_open(struct i2c_bus *bus, const char *device,
+                 enum i2c_path_mode path);
+/* Dumps the statistics, if enabled, before closing */
+void i2c_bus_close(struct i2c_bus *bus);
+
+int i2c_stats_enable(struct i2c_bus *bus, FILE *out);
+void i2c_stats_dump(struct i2c_bus *bus, FILE *out);
+/*
+ * Make SIGUSR1 dump the statistics of every instrumented bus.  The dump
+ * happens at the bus's next transaction, or when its owner calls
+ * i2c_stats_poll(); i2c_stats_signal_fd() becomes readable on SIGUSR1 so
+ * a waiting loop can watch it next to its own descriptors.
+ */
+void i2c_stats_install_signal(void);
+/* Read end of the SIGUSR1 self-pipe, -1 before i2c_stats_install_signal() */
+int i2c_stats_signal_fd(void);
+/* Drain the self-pipe and dump [bus] if SIGUSR1 arrived since its last dump */
+void i2c_stats_poll(struct i2c_bus *bus);
+
+int i2c_transfer(struct i2c_bus *bus, struct i2c_msg *messages, int nmsgs);
+int i2c_smbus_access(struct i2c_bus *bus,
+                     unsigned char addr,
+                     char read_write,
+                     unsigned char command,
+                     int size,
+                     union i2c_smbus_data *data);
+int i2c_use_smbus(struct i2c_bus *bus, unsigned long func);
+int i2c_use_rdwr(struct i2c_bus *bus);
+unsigned short i2c_block_limit(struct i2c_bus *bus, unsigned long func);
+
+int i2c_write_byte(struct i2c_bus *bus,
+                   unsigned char addr,
+                   unsigned char reg,
+                   unsigned char value);
+int i2c_read_byte(struct i2c_bus *bus,
+                  unsigned char addr,
+                  unsigned char reg,
+                  unsigned char *val);
+int i2c_read_word(struct i2c_bus *bus,
+                  unsigned char addr,
+                  unsigned char reg,
+                  unsigned short *val);
+int i2c_read_block(struct i2c_bus *bus,
+                   unsigned char addr,
+                   unsigned char reg,
+                   unsigned char *buf,
+                   unsigned short len);
+int i2c_read_smbus_block(struct i2c_bus *bus,
+                         unsigned char addr,
+                         unsigned char reg,
+                         unsigned char *buf);
+int i2c_write_block(struct i2c_bus *bus,
+                    unsigned char addr,
+                    unsigned char reg,
+                    const unsigned char *buf,
+                    unsigned short len);
+int i2c_read_range(struct i2c_bus *bus,
+                   unsigned char addr,
+                   unsigned char reg,
+                   unsigned char *buf,
+                   int count);
+int get_i2c_block(struct i2c_bus *bus,
+                  unsigned char addr,
+                  unsigned char reg,
+                  unsigned char *buf,
+                  unsigned short len);
+int get_i2c_register_batch(struct i2c_bus *bus,
+                           unsigned char addr,
+                           const unsigned char *regs,
+                           unsigned char *vals,
+                           int n);
+
+int set_i2c_register(struct i2c_bus *bus,
+                     unsigned char addr,
+                     unsigned char reg,
+                     unsigned char value);
+int get_i2c_register(struct i2c_bus *bus,
+                     unsigned char addr,
+                     unsigned char reg,
+                     unsigned char *val);
+
+
+/* Longest transfer a single asynchronous request may carry */
+#define I2C_ASYNC_MAX_LEN I2C_SMBUS_BLOCK_MAX
+
+struct i2c_request;
+typedef void (*i2c_callback)(struct i2c_request *req, void *arg);
+
+/*
+ * One queued transfer: read or write [len] bytes at register [reg].  The
+ * request must stay valid until it completes.  With a [callback], it runs
+ * on the worker thread once the transfer finished and the library does
+ * not touch the request afterwards; without one, i2c_async_wait() is the
+ * future to block on.
+ */
+struct i2c_request {
+    unsigned char addr;
+    unsigned char reg;
+    unsigned char *buf;
+    unsigned short len;
+    int write;
+    i2c_callback callback;
+    void *arg;
+
+    /* Owned by the library */
+    int status;
+    int done;
+    struct i2c_async *async;
+    struct i2c_request *next;
+};
+
+struct i2c_async_stats {
+    unsigned long long requests;
+    /* I2C_RDWR calls that carried more than one request */
+    unsigned long long batches;
+    unsigned long long batched_requests;
+    /* Read batches that failed and were replayed one request at a time */
+    unsigned long long replays;
+};
+
+/* Per-bus worker; the bus must not be used directly while it runs */
+struct i2c_async {
+    struct i2c_bus *bus;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t completed;
+    struct i2c_request *head;
+    struct i2c_request *tail;
+    int stopping;
+    struct i2c_async_stats stats;
+};
+
+int i2c_async_start(struct i2c_async *async, struct i2c_bus *bus);
+/* Finishes every queued request, then stops the worker */
+void i2c_async_stop(struct i2c_async *async);
+int i2c_async_submit(struct i2c_async *async, struct i2c_request *req);
+int i2c_async_wait(struct i2c_request *req);
+void i2c_async_get_stats(struct i2c_async *async,
+                         struct i2c_async_stats *stats);
+
+#endif /* I2C_LIB_H */
@@ -0,0 +1,412 @@
+/*
+ * I2C register sampler
+ *
+ * Binds an I2C client at a configurable address and reads a window of its
+ * registers at a fixed rate from a kernel thread.  Each sample is queued in
+ * a ring buffer as
+ *
+ *   u64 timestamp (CLOCK_MONOTONIC, ns) + one byte per register
+ *
+ * and userspace drains whole records in bulk with read(), optionally
+ * waiting with poll().  Compared to i2c-app in a loop this saves the two
+ * ioctls and the wakeup per register read.
+ *
+ * Try it against i2c-stub:
+ *   modprobe i2c-stub chip_addr=0x50
+ *   insmod i2c-sampler.ko bus=<stub bus> addr=0x50 reg=0 count=16 period_us=1000
+ *   mknod /dev/i2c-sampler c 240 0
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/i2c.h>
+#include <linux/kthread.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/kref.h>
+
+/*
+ * Debug option
+ */
+#define I2C_SAMPLER_MODULE_DEBUG
+
+#undef PDEBUG
+#ifdef I2C_SAMPLER_MODULE_DEBUG
+#  ifdef __KERNEL__
+#    define PDEBUG(fmt, args...) printk(KERN_DEBUG "[i2c-sampler] " fmt, ## args)
+#  else
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...)
+#endif
+
+/* Module major number */
+static int DEV_SAMPLER_MAJOR_NUMBER = 240;
+/* Module name */
+#define DEV_SAMPLER_NAME "i2c-sampler"
+
+/* Largest register window, one SMBus I2C block read */
+#define SAMPLER_MAX_REGS I2C_SMBUS_BLOCK_MAX
+
+/* Ring buffer size in bytes, must be a power of two */
+#define SAMPLER_FIFO_SIZE (64 * 1024)
+
+static int bus;
+module_param(bus, int, 0444);
+MODULE_PARM_DESC(bus, "I2C adapter number");
+
+static unsigned short addr = 0x50;
+module_param(addr, ushort, 0444);
+MODULE_PARM_DESC(addr, "7-bit slave address to sample");
+
+static unsigned int reg;
+module_param(reg, uint, 0444);
+MODULE_PARM_DESC(reg, "First register of the window");
+
+static unsigned int count = 1;
+module_param(count, uint, 0444);
+MODULE_PARM_DESC(count, "Number of registers per sample (1-32)");
+
+static unsigned int period_us = 1000;
+module_param(period_us, uint, 0444);
+MODULE_PARM_DESC(period_us, "Sampling period in microseconds");
+
+/*
+ * One per bound client.  Open files hold a reference, so the state
+ * outlives an unbind or adapter removal until the last close; gone is
+ * set then and turns reads away.
+ */
+struct sampler {
+	struct kref ref;
+	bool gone;
+	struct i2c_client *client;
+	struct task_struct *thread;
+	/* filled by the sampling thread only, drained by readers */
+	DECLARE_KFIFO(fifo, u8, SAMPLER_FIFO_SIZE);
+	/* serializes readers against each other */
+	struct mutex read_lock;
+	wait_queue_head_t wait;
+	unsigned int rec_size;
+	/* statistics, printed on unload */
+	unsigned long samples;
+	unsigned long dropped;
+	unsigned long errors;
+	unsigned long missed;
+};
+
+/* the bound sampler, protected by sampler_lock */
+static struct sampler *cur_sampler;
+static DEFINE_MUTEX(sampler_lock);
+static struct i2c_client *sampler_client;
+
+
+static void sampler_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct sampler, ref));
+}
+
+
+/* read the whole register window once into buf */
+static int sampler_read_window(struct i2c_client *client, u8 *buf)
+{
+	int i, ret;
+
+	if (i2c_check_functionality(client->adapter,
+				    I2C_FUNC_SMBUS_READ_I2C_BLOCK)) {
+		ret = i2c_smbus_read_i2c_block_data(client, reg, count, buf);
+		return ret == count ? 0 : (ret < 0 ? ret : -EIO);
+	}
+
+	/* adapter without block reads: one byte at a time */
+	for (i = 0; i < count; i++) {
+		ret = i2c_smbus_read_byte_data(client, reg + i);
+		if (ret < 0) {
+			return ret;
+		}
+		buf[i] = ret;
+	}
+	return 0;
+}
+
+/*
+ * Sampling loop.  Deadlines are absolute, so transfer time does not add
+ * up as drift; if a transfer overruns one or more periods we count them
+ * as missed and resynchronize instead of firing a burst of late samples.
+ */
+static int sampler_thread(void *data)
+{
+	struct sampler *s = data;
+	u8 rec[sizeof(u64) + SAMPLER_MAX_REGS];
+	ktime_t period = ns_to_ktime((u64)period_us * NSEC_PER_USEC);
+	ktime_t next = ktime_add(ktime_get(), period);
+
+	while (!kthread_should_stop()) {
+		u64 ts;
+		ktime_t now;
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&next, 0, HRTIMER_MODE_ABS);
+		if (kthread_should_stop()) {
+			break;
+		}
+
+		ts = ktime_get_ns();
+		if (sampler_read_window(s->client, rec + sizeof(u64)) != 0) {
+			s->errors++;
+		} else if (kfifo_avail(&s->fifo) < s->rec_size) {
+			s->dropped++;
+		} else {
+			memcpy(rec, &ts, sizeof(ts));
+			kfifo_in(&s->fifo, rec, s->rec_size);
+			s->samples++;
+			wake_up_interruptible(&s->wait);
+		}
+
+		next = ktime_add(next, period);
+		now = ktime_get();
+		if (ktime_before(next, now)) {
+			s->missed += ktime_divns(ktime_sub(now, next),
+						 ktime_to_ns(period)) + 1;
+			next = ktime_add(now, period);
+		}
+	}
+	return 0;
+}
+
+
+static int sampler_open(struct inode *inode, struct file *filp)
+{
+	struct sampler *s;
+
+	mutex_lock(&sampler_lock);
+	s = cur_sampler;
+	if (s) {
+		kref_get(&s->ref);
+	}
+	mutex_unlock(&sampler_lock);
+	if (!s) {
+		return -ENODEV;
+	}
+	filp->private_data = s;
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+static int sampler_release(struct inode *inode, struct file *filp)
+{
+	struct sampler *s = filp->private_data;
+
+	kref_put(&s->ref, sampler_free);
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	return 0;
+}
+
+/* hand out as many whole records as fit into the user buffer */
+static ssize_t sampler_read(struct file *filp, char __user *buf, size_t len, loff_t *f_pos)
+{
+	struct sampler *s = filp->private_data;
+	unsigned int want, copied;
+	int ret;
+
+	want = min_t(size_t, len, SAMPLER_FIFO_SIZE);
+	want -= want % s->rec_size;
+	if (want == 0) {
+		return -EINVAL;
+	}
+
+	if (mutex_lock_interruptible(&s->read_lock)) {
+		return -ERESTARTSYS;
+	}
+
+	while (kfifo_len(&s->fifo) < s->rec_size || READ_ONCE(s->gone)) {
+		mutex_unlock(&s->read_lock);
+		if (READ_ONCE(s->gone)) {
+			return -ENODEV;
+		}
+		if (filp->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(s->wait,
+				kfifo_len(&s->fifo) >= s->rec_size ||
+				READ_ONCE(s->gone))) {
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&s->read_lock)) {
+			return -ERESTARTSYS;
+		}
+	}
+
+	want = min(want, kfifo_len(&s->fifo) - kfifo_len(&s->fifo) % s->rec_size);
+	ret = kfifo_to_user(&s->fifo, buf, want, &copied);
+	mutex_unlock(&s->read_lock);
+
+	return ret ? ret : copied;
+}
+
+static __poll_t sampler_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct sampler *s = filp->private_data;
+
+	poll_wait(filp, &s->wait, wait);
+	/* the client went away: read() fails with -ENODEV */
+	if (READ_ONCE(s->gone)) {
+		return EPOLLERR | EPOLLHUP;
+	}
+	if (kfifo_len(&s->fifo) >= s->rec_size) {
+		return EPOLLIN | EPOLLRDNORM;
+	}
+	return 0;
+}
+
+static struct file_operations sampler_fops = {
+	.owner = THIS_MODULE,
+	.open = sampler_open,
+	.release = sampler_release,
+	.read = sampler_read,
+	.poll = sampler_poll
+};
+
+
+static int sampler_probe(struct i2c_client *client)
+{
+	struct sampler *s;
+	int ret;
+
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s) {
+		return -ENOMEM;
+	}
+
+	kref_init(&s->ref);
+	s->client = client;
+	s->rec_size = sizeof(u64) + count;
+	INIT_KFIFO(s->fifo);
+	mutex_init(&s->read_lock);
+	init_waitqueue_head(&s->wait);
+	i2c_set_clientdata(client, s);
+
+	s->thread = kthread_run(sampler_thread, s, "i2c-sampler-%d", bus);
+	if (IS_ERR(s->thread)) {
+		ret = PTR_ERR(s->thread);
+		kfree(s);
+		return ret;
+	}
+	mutex_lock(&sampler_lock);
+	cur_sampler = s;
+	mutex_unlock(&sampler_lock);
+
+	PDEBUG("sampling 0x%02x regs 0x%02x..0x%02x every %u us\n",
+	       client->addr, reg, reg + count - 1, period_us);
+	return 0;
+}
+
+static void sampler_remove(struct i2c_client *client)
+{
+	struct sampler *s = i2c_get_clientdata(client);
+
+	kthread_stop(s->thread);
+	mutex_lock(&sampler_lock);
+	cur_sampler = NULL;
+	mutex_unlock(&sampler_lock);
+
+	/* readers still holding the file see -ENODEV from now on */
+	WRITE_ONCE(s->gone, true);
+	wake_up_interruptible(&s->wait);
+
+	PDEBUG("samples %lu, dropped %lu, errors %lu, missed %lu\n",
+	       s->samples, s->dropped, s->errors, s->missed);
+	kref_put(&s->ref, sampler_free);
+}
+
+static const struct i2c_device_id sampler_id[] = {
+	{ DEV_SAMPLER_NAME, 0 },
+	{ }
+};
+MODULE_DEVICE_TABLE(i2c, sampler_id);
+
+static struct i2c_driver sampler_driver = {
+	.driver = {
+		.name = DEV_SAMPLER_NAME,
+	},
+	.probe = sampler_probe,
+	.remove = sampler_remove,
+	.id_table = sampler_id,
+};
+
+
+static int sampler_init(void)
+{
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO(DEV_SAMPLER_NAME, 0),
+	};
+	struct i2c_adapter *adapter;
+	int ret;
+
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+
+	if (count == 0 || count > SAMPLER_MAX_REGS || reg + count > 256 ||
+	    period_us == 0) {
+		return -EINVAL;
+	}
+
+	ret = register_chrdev(DEV_SAMPLER_MAJOR_NUMBER, DEV_SAMPLER_NAME, &sampler_fops);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = i2c_add_driver(&sampler_driver);
+	if (ret) {
+		goto err_chrdev;
+	}
+
+	adapter = i2c_get_adapter(bus);
+	if (!adapter) {
+		ret = -ENODEV;
+		goto err_driver;
+	}
+
+	/* instantiate the client ourselves; this binds it to sampler_driver */
+	info.addr = addr;
+	sampler_client = i2c_new_client_device(adapter, &info);
+	i2c_put_adapter(adapter);
+	if (IS_ERR(sampler_client)) {
+		ret = PTR_ERR(sampler_client);
+		goto err_driver;
+	}
+	mutex_lock(&sampler_lock);
+	ret = cur_sampler ? 0 : -ENODEV;
+	mutex_unlock(&sampler_lock);
+	if (ret) {
+		goto err_client;
+	}
+	return 0;
+
+err_client:
+	i2c_unregister_device(sampler_client);
+err_driver:
+	i2c_del_driver(&sampler_driver);
+err_chrdev:
+	unregister_chrdev(DEV_SAMPLER_MAJOR_NUMBER, DEV_SAMPLER_NAME);
+	return ret;
+}
+
+static void sampler_exit(void)
+{
+	PDEBUG("%s:%d\n", __FUNCTION__, __LINE__);
+	i2c_unregister_device(sampler_client);
+	i2c_del_driver(&sampler_driver);
+	unregister_chrdev(DEV_SAMPLER_MAJOR_NUMBER, DEV_SAMPLER_NAME);
+}
+
+
+module_init(sampler_init);
+module_exit(sampler_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Buffered I2C register sampler");